@@ -125,18 +125,58 @@ def main() -> None:
         help="exposure time, in seconds",
         type=int,
     )
+    parser.add_argument(
+        "-g",
+        "--gc",
+        help="tag the samples taken during garbage collection",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--census",
+        help="take a census of the GC-tracked objects by type every SECONDS seconds instead of sampling stacks",
+        metavar="SECONDS",
+        type=int,
+    )
     parser.add_argument(
         "-m",
         "--memory",
         help="Collect memory allocation events",
         action="store_true",
     )
+    parser.add_argument(
+        "--memory-sampling-rate",
+        help="only record one allocation every N bytes on average, e.g. 524288 (implies --memory)",
+        metavar="N",
+        type=int,
+    )
     parser.add_argument(
         "-n",
         "--native",
         help="sample native stacks",
         action="store_true",
     )
+    parser.add_argument(
+        "--native-perf",
+        help="sample native stacks with perf events instead of signals (Linux only, implies --native)",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--native-leaf",
+        help="only sample the top K native frames and attach them to the Python stacks (implies --native)",
+        metavar="K",
+        type=int,
+    )
+    parser.add_argument(
+        "--task-sample-size",
+        help="only sample K idle asyncio tasks per thread at each tick and scale their metrics accordingly",
+        metavar="K",
+        type=int,
+    )
+    parser.add_argument(
+        "--idle",
+        help="report event loops waiting for I/O as idle, without unwinding their tasks",
+        action="store_true",
+    )
     parser.add_argument(
         "-o",
         "--output",
@@ -194,8 +234,17 @@ def main() -> None:
 
     env["ECHION_INTERVAL"] = str(args.interval)
     env["ECHION_CPU"] = str(int(bool(args.cpu)))
-    env["ECHION_MEMORY"] = str(int(bool(args.memory)))
-    env["ECHION_NATIVE"] = str(int(bool(args.native)))
+    env["ECHION_MEMORY"] = str(int(bool(args.memory or args.memory_sampling_rate)))
+    env["ECHION_MEMORY_SAMPLING_RATE"] = str(args.memory_sampling_rate or 0)
+    env["ECHION_NATIVE"] = str(
+        int(bool(args.native or args.native_perf or args.native_leaf))
+    )
+    env["ECHION_NATIVE_PERF"] = str(int(bool(args.native_perf)))
+    env["ECHION_NATIVE_LEAF"] = str(args.native_leaf or 0)
+    env["ECHION_TASK_SAMPLE_SIZE"] = str(args.task_sample_size or 0)
+    env["ECHION_IDLE"] = str(int(bool(args.idle)))
+    env["ECHION_GC"] = str(int(bool(args.gc)))
+    env["ECHION_CENSUS"] = str(args.census or 0)
     env["ECHION_OUTPUT"] = args.output.replace("%%(pid)", str(os.getpid()))
     env["ECHION_STEALTH"] = str(int(bool(args.stealth)))
     env["ECHION_WHERE"] = str(args.where or "")
@@ -33,7 +33,14 @@ def start():
     ec.set_interval(int(os.getenv("ECHION_INTERVAL", 1000)))
     ec.set_cpu(bool(int(os.getenv("ECHION_CPU", 0))))
     ec.set_memory(bool(int(os.getenv("ECHION_MEMORY", 0))))
+    ec.set_memory_sampling_rate(int(os.getenv("ECHION_MEMORY_SAMPLING_RATE", 0)))
     ec.set_native(bool(int(os.getenv("ECHION_NATIVE", 0))))
+    ec.set_native_perf(bool(int(os.getenv("ECHION_NATIVE_PERF", 0))))
+    ec.set_native_leaf(int(os.getenv("ECHION_NATIVE_LEAF", 0)))
+    ec.set_task_sample_size(int(os.getenv("ECHION_TASK_SAMPLE_SIZE", 0)))
+    ec.set_idle(bool(int(os.getenv("ECHION_IDLE", 0))))
+    ec.set_gc(bool(int(os.getenv("ECHION_GC", 0))))
+    ec.set_census(int(os.getenv("ECHION_CENSUS", 0)))
     ec.set_where(bool(int(os.getenv("ECHION_WHERE", 0) or 0)))
 
     # Monkey-patch the standard library on import
@@ -45,7 +52,7 @@ def start():
         # hooks.
         pass
     else:
-        for module in ("asyncio", "threading", "gevent"):
+        for module in ("asyncio", "threading", "gevent", "uvloop"):
 
             @ModuleWatchdog.after_module_imported(module)
             def _(module: ModuleType) -> None:
@@ -71,7 +78,7 @@ def stop():
 
     ec.stop()
 
-    for module in ("asyncio", "threading"):
+    for module in ("asyncio", "threading", "uvloop"):
         echion_module = f"echion.monkey.{module}"
         try:
             sys.modules[echion_module].unpatch()
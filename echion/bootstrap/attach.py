@@ -8,7 +8,15 @@ import typing as t
 
 def attach(config: t.Dict[str, str], pipe_name: t.Optional[str] = None) -> None:
     os.environ["ECHION_CPU"] = str(int(config["cpu"]))
-    os.environ["ECHION_NATIVE"] = str(int(config["native"]))
+    os.environ["ECHION_NATIVE"] = str(
+        int(config["native"] or config["native_perf"] or bool(config["native_leaf"]))
+    )
+    os.environ["ECHION_NATIVE_PERF"] = str(int(config["native_perf"]))
+    os.environ["ECHION_NATIVE_LEAF"] = str(int(config["native_leaf"] or 0))
+    os.environ["ECHION_TASK_SAMPLE_SIZE"] = str(int(config["task_sample_size"] or 0))
+    os.environ["ECHION_IDLE"] = str(int(config["idle"]))
+    os.environ["ECHION_GC"] = str(int(config["gc"]))
+    os.environ["ECHION_CENSUS"] = str(int(config["census"] or 0))
     os.environ["ECHION_OUTPUT"] = config["output"]
     os.environ["ECHION_STEALTH"] = str(int(config["stealth"]))
     os.environ["ECHION_WHERE"] = str(int(bool(config["where"])))
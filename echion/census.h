@@ -0,0 +1,282 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+
+#include <echion/frame.h>
+#include <echion/interp.h>
+#include <echion/render.h>
+#include <echion/state.h>
+#include <echion/strings.h>
+#include <echion/vm.h>
+
+// ----------------------------------------------------------------------------
+// Upper bound on the number of objects that are read from each GC list. The
+// lists are read without the GIL, so this guards against following a list that
+// is being modified into a loop.
+inline constexpr size_t CENSUS_MAX_OBJECTS = 1 << 24;
+
+// Maximum length of the type names that we read
+inline constexpr size_t CENSUS_MAX_NAME = 256;
+
+// ----------------------------------------------------------------------------
+struct CensusEntry
+{
+    size_t count = 0;
+    ssize_t size = 0;
+};
+
+// The number and size of the GC-tracked objects, by type name
+using Census = std::unordered_map<StringTable::Key, CensusEntry>;
+
+// ----------------------------------------------------------------------------
+// Read a NUL-terminated string, one chunk at a time so that we never read past
+// the end of the page that contains it.
+static bool read_c_string(const char* addr, std::string& result)
+{
+    result.clear();
+
+    while (result.size() < CENSUS_MAX_NAME)
+    {
+        char chunk[64];
+        size_t to_page_end = 4096 - (reinterpret_cast<uintptr_t>(addr) & 4095);
+        size_t n = std::min(sizeof(chunk), to_page_end);
+
+        if (copy_generic(addr, chunk, n))
+            return false;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (chunk[i] == '\0')
+                return true;
+            result += chunk[i];
+        }
+
+        addr += n;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+class HeapCensus
+{
+public:
+    // ------------------------------------------------------------------------
+    // Count the objects in the GC generation lists of the given interpreter,
+    // by type. This can run without the GIL, in which case the result is only
+    // an estimate, as the lists can change while we are reading them. Young
+    // collections are frequent and only move a few objects between lists, so
+    // we live with them. We give up if a collection of the oldest generation
+    // runs in the meantime, as it moves the bulk of the heap. Return whether
+    // the census was taken.
+    static bool take(InterpreterInfo& interp, Census& census)
+    {
+#ifdef Py_GIL_DISABLED
+        // There are no generation lists on free-threaded builds.
+        (void)interp;
+        (void)census;
+        return false;
+#else
+#if PY_VERSION_HEX >= 0x03090000
+        auto* state = reinterpret_cast<struct _gc_runtime_state*>(
+            static_cast<char*>(interp.addr) + offsetof(PyInterpreterState, gc));
+#else
+        (void)interp;
+        auto* state = &runtime->gc;
+#endif
+
+        auto collections = gc_progress(state);
+        if (collections < 0)
+            return false;
+
+#if PY_VERSION_HEX >= 0x030e0000
+        // The incremental collector has a young generation and an old one that
+        // is split into two spaces, which it swaps between increments.
+        PyGC_Head* heads[] = {&state->young.head, &state->old[0].head, &state->old[1].head,
+                              &state->permanent_generation.head};
+#else
+        PyGC_Head* heads[NUM_GENERATIONS + 1];
+        for (int i = 0; i < NUM_GENERATIONS; i++)
+            heads[i] = &state->generations[i].head;
+        heads[NUM_GENERATIONS] = &state->permanent_generation.head;
+#endif
+
+        auto is_head = [&](PyGC_Head* node) {
+            return std::find(std::begin(heads), std::end(heads), node) != std::end(heads);
+        };
+
+        std::unordered_map<PyTypeObject*, TypeInfo> types;
+
+        for (auto* head : heads)
+        {
+            PyGC_Head gc;
+            if (copy_type(head, gc))
+                return false;
+
+            // An object that is moved to another list while we are reading
+            // takes us to the head of that list, so we stop at any head.
+            size_t n = 0;
+            for (auto* node = next(gc); node != NULL && !is_head(node) && n < CENSUS_MAX_OBJECTS;
+                 node = next(gc), n++)
+            {
+                // The object follows its GC header. We read the header of a
+                // variable-size object, as all the GC-tracked objects are at
+                // least as large.
+                struct
+                {
+                    PyGC_Head gc;
+                    PyVarObject object;
+                } item;
+                if (copy_type(node, item))
+                    break;
+                gc = item.gc;
+
+                auto* type_addr = Py_TYPE(&item.object);
+                auto type = types.find(type_addr);
+                if (type == types.end())
+                    type = types.emplace(type_addr, read_type(type_addr)).first;
+
+                if (type->second.name == 0)
+                    continue;
+
+                auto& entry = census[type->second.name];
+                entry.count++;
+                entry.size += type->second.basicsize;
+                if (type->second.itemsize)
+                    entry.size += std::abs(item.object.ob_size) * type->second.itemsize;
+            }
+        }
+
+        // Discard the census if the oldest generation has been collected in
+        // the meantime, or might be being collected.
+        return gc_progress(state) == collections;
+#endif  // Py_GIL_DISABLED
+    }
+
+    // ------------------------------------------------------------------------
+    // Take a census of each interpreter and emit the change in the size of the
+    // objects of each type since the previous one, so that the sum of all the
+    // emitted values gives the latest census. Return whether the census of
+    // every interpreter was taken.
+    bool update()
+    {
+        bool complete = true;
+
+        for_each_interp([this, &complete](InterpreterInfo& interp) {
+            Census census;
+            if (!take(interp, census))
+            {
+                complete = false;
+                return;
+            }
+
+            auto& last = previous[interp.id];
+
+            for (auto& [name, entry] : census)
+            {
+                auto last_entry = last.find(name);
+                ssize_t delta = entry.size - (last_entry != last.end() ? last_entry->second.size : 0);
+                if (delta)
+                    render(interp.id, name, delta);
+            }
+
+            for (auto& [name, entry] : last)
+                if (census.find(name) == census.end() && entry.size)
+                    render(interp.id, name, -entry.size);
+
+            last = std::move(census);
+        });
+
+        return complete;
+    }
+
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        previous.clear();
+    }
+
+private:
+    struct TypeInfo
+    {
+        StringTable::Key name = 0;
+        Py_ssize_t basicsize = 0;
+        Py_ssize_t itemsize = 0;
+    };
+
+    std::unordered_map<int64_t, Census> previous;
+
+    // ------------------------------------------------------------------------
+    // Get the number of collections of the oldest generation, or -1 if a
+    // collection is running, as we cannot tell which generation it is for. On
+    // 3.14 the last stats are those of the full collections, as the old
+    // generation is otherwise collected in small increments.
+    static Py_ssize_t gc_progress(struct _gc_runtime_state* state)
+    {
+        int collecting = 0;
+        if (copy_type(&state->collecting, collecting) || collecting)
+            return -1;
+
+        struct gc_generation_stats stats;
+        if (copy_type(&state->generation_stats[NUM_GENERATIONS - 1], stats))
+            return -1;
+
+        return stats.collections;
+    }
+
+    // ------------------------------------------------------------------------
+    static inline PyGC_Head* next(PyGC_Head& gc)
+    {
+        // The lowest bits are used as flags during collections.
+        return reinterpret_cast<PyGC_Head*>(gc._gc_next & ~static_cast<uintptr_t>(3));
+    }
+
+    // ------------------------------------------------------------------------
+    static TypeInfo read_type(PyTypeObject* type_addr)
+    {
+        TypeInfo info;
+
+        PyTypeObject type;
+        if (copy_type(type_addr, type))
+            return info;
+
+        std::string name;
+        if (type.tp_name == NULL || !read_c_string(type.tp_name, name))
+            return info;
+
+        // Type names are keyed by their hash rather than by the address of the
+        // type, which could be that of a string that is still in the table.
+        // The top bit is set so that the key cannot be a valid address.
+        info.name = string_table.key(std::hash<std::string>()(name) | (1ULL << 63), name);
+        info.basicsize = type.tp_basicsize;
+        info.itemsize = type.tp_itemsize;
+
+        return info;
+    }
+
+    // ------------------------------------------------------------------------
+    static void render(int64_t iid, StringTable::Key name, ssize_t delta)
+    {
+        Renderer::get().render_stack_begin(pid, iid, "Heap census");
+        Renderer::get().render_frame(Frame::get(name));
+        Renderer::get().render_stack_end(MetricType::Memory, delta);
+    }
+};
+
+// We make this a reference to a heap-allocated object so that we can avoid
+// the destruction on exit. We are in charge of cleaning up the object. Note
+// that the object will leak, but this is not a problem.
+inline auto& heap_census = *(new HeapCensus());
@@ -22,9 +22,30 @@ inline bool ignore_non_running_threads = true;
 // Memory events
 inline int memory = 0;
 
+// Mean number of bytes between sampled allocations in memory mode (0 = all)
+inline unsigned int memory_sampling_rate = 0;
+
 // Native stack sampling
 inline int native = 0;
 
+// Sample native stacks with perf events instead of signals (Linux only)
+inline int native_perf = 0;
+
+// Only collect this many native frames on top of the Python stack (0 = all)
+inline unsigned int native_leaf = 0;
+
+// Only unwind this many idle leaf tasks per sample (0 = all)
+inline unsigned int task_sample_size = 0;
+
+// Report event loops that are waiting for I/O as idle, without unwinding tasks
+inline int idle = 0;
+
+// Tag the samples taken while the garbage collector is running
+inline int gc = 0;
+
+// Take a census of the GC-tracked objects every this many seconds (0 = off)
+inline unsigned int census = 0;
+
 // Where mode
 inline int where = 0;
 
@@ -100,6 +121,101 @@ static PyObject* set_native(PyObject* Py_UNUSED(m), PyObject* args)
     Py_RETURN_NONE;
 }
 
+// ----------------------------------------------------------------------------
+static PyObject* set_native_perf(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    int value;
+    if (!PyArg_ParseTuple(args, "p", &value))
+        return NULL;
+
+    native_perf = value;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_native_leaf(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int value;
+    if (!PyArg_ParseTuple(args, "I", &value))
+        return NULL;
+
+    native_leaf = value;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_memory_sampling_rate(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int value;
+    if (!PyArg_ParseTuple(args, "I", &value))
+        return NULL;
+
+    memory_sampling_rate = value;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_task_sample_size(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int value;
+    if (!PyArg_ParseTuple(args, "I", &value))
+        return NULL;
+
+    task_sample_size = value;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_idle(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    int value;
+    if (!PyArg_ParseTuple(args, "p", &value))
+        return NULL;
+
+    idle = value;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_gc(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    int value;
+    if (!PyArg_ParseTuple(args, "p", &value))
+        return NULL;
+
+    gc = value;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_census(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int value;
+    if (!PyArg_ParseTuple(args, "I", &value))
+        return NULL;
+
+#ifdef Py_GIL_DISABLED
+    if (value)
+    {
+        // The free-threaded build does not keep the GC-tracked objects in
+        // generation lists, so there is nothing to walk.
+        PyErr_SetString(PyExc_RuntimeError,
+                        "The heap census is not supported on free-threaded builds");
+        return NULL;
+    }
+#endif  // Py_GIL_DISABLED
+
+    census = value;
+
+    Py_RETURN_NONE;
+}
+
 // ----------------------------------------------------------------------------
 static PyObject* set_where(PyObject* Py_UNUSED(m), PyObject* args)
 {
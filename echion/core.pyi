@@ -21,6 +21,16 @@ def init_asyncio(
     threads: list, scheduled_tasks: set, eager_tasks: set | None
 ) -> None: ...
 def link_tasks(parent: Task, child: Task) -> None: ...
+def link_current_task(
+    loop: BaseEventLoop | None, children: t.Iterable[t.Any]
+) -> None: ...
+def loop_stats() -> t.Dict[int, t.Dict[str, float]]: ...
+
+# Memory mode
+def heap_snapshot() -> t.Dict[t.Tuple[t.Tuple[str, str, int], ...], t.Tuple[int, int]]: ...
+def rss_growth() -> t.Dict[t.Tuple[t.Tuple[str, str, int], ...], int]: ...
+def lifetimes() -> t.Dict[t.Tuple[t.Tuple[str, str, int], ...], t.Tuple[int, ...]]: ...
+def type_census() -> t.Dict[str, t.Tuple[int, int]]: ...
 
 # Greenlet support
 def track_greenlet(
@@ -29,12 +39,24 @@ def track_greenlet(
 def untrack_greenlet(greenlet_id: int) -> None: ...
 def link_greenlets(greenlet_id: int, parent_id: int) -> None: ...
 def update_greenlet_frame(greenlet_id: int, frame: FrameType | bool | None) -> None: ...
+def init_greenlet_tracer(
+    track: t.Callable[[t.Any], t.Any] | None,
+    original: t.Callable[[str, t.Any], t.Any] | None,
+) -> None: ...
+def greenlet_tracer(event: str, args: t.Any) -> None: ...
 
 # Configuration interface
 def set_interval(interval: int) -> None: ...
 def set_cpu(cpu: bool) -> None: ...
 def set_memory(memory: bool) -> None: ...
+def set_memory_sampling_rate(rate: int) -> None: ...
 def set_native(native: bool) -> None: ...
+def set_native_perf(native_perf: bool) -> None: ...
+def set_native_leaf(native_leaf: int) -> None: ...
+def set_task_sample_size(task_sample_size: int) -> None: ...
+def set_idle(idle: bool) -> None: ...
+def set_gc(gc: bool) -> None: ...
+def set_census(census: int) -> None: ...
 def set_where(where: bool) -> None: ...
 def set_pipe_name(name: str) -> None: ...
 def set_max_frames(max_frames: int) -> None: ...
@@ -14,6 +14,8 @@
 #include <iostream>
 #include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <fcntl.h>
 #include <sched.h>
@@ -25,6 +27,7 @@
 #include <pthread.h>
 #endif
 
+#include <echion/census.h>
 #include <echion/config.h>
 #include <echion/greenlets.h>
 #include <echion/interp.h>
@@ -44,7 +47,8 @@ static void do_where(std::ostream& stream)
     WhereRenderer::get().render_message("");
 
     for_each_interp([](InterpreterInfo& interp) -> void {
-        for_each_thread(interp, [](PyThreadState* tstate, ThreadInfo& thread) -> void {
+        auto for_each = native ? for_each_thread_native : for_each_thread;
+        for_each(interp, [](PyThreadState* tstate, ThreadInfo& thread) -> void {
             thread.unwind(tstate);
             WhereRenderer::get().render_thread_begin(tstate, thread.name, /*cpu_time*/ 0,
                                                      tstate->thread_id, thread.native_id);
@@ -114,6 +118,37 @@ static inline void _start()
         return;
     }
 
+    if (native && native_perf)
+    {
+        if (native_leaf)
+        {
+            // The leaf frames would be attached to a Python stack that is
+            // read at a different time.
+            std::cerr << "Perf events are not supported in native leaf mode, falling back to "
+                         "signals for native stack sampling"
+                      << std::endl;
+            native_perf = 0;
+        }
+        else
+#ifdef PERF_NATIVE_SUPPORTED
+        if (!perf_events_available())
+#endif  // PERF_NATIVE_SUPPORTED
+        {
+            std::cerr << "Perf events are not available, falling back to signals for native "
+                         "stack sampling"
+                      << std::endl;
+            native_perf = 0;
+        }
+    }
+
+#if defined PL_LINUX
+    if (native && !native_perf && !native_leaf && safe_copy != process_vm_readv)
+        // See NativeSampleSlot::write
+        std::cerr << "process_vm_readv is not available, native stacks can only be sampled in "
+                     "leaf mode"
+                  << std::endl;
+#endif  // PL_LINUX
+
     install_signals();
 
 #if defined PL_DARWIN
@@ -143,6 +178,13 @@ static inline void _start()
     if (memory)
     {
         Renderer::get().metadata("mode", "memory");
+        if (memory_sampling_rate)
+            Renderer::get().metadata("memory_sampling_rate", std::to_string(memory_sampling_rate));
+    }
+    else if (census)
+    {
+        Renderer::get().metadata("mode", "memory");
+        Renderer::get().metadata("census", std::to_string(census));
     }
     else
     {
@@ -169,6 +211,8 @@ static inline void _stop()
 {
     if (memory)
         teardown_memory();
+    else if (census)
+        heap_census.clear();
 
     // Clean up the thread info map. When not running async, we need to guard
     // the map lock because we are not in control of the sampling thread.
@@ -179,6 +223,8 @@ static inline void _stop()
         string_table.clear();
     }
 
+    task_link_map.clear();
+
     teardown_where();
 
 #if defined PL_DARWIN
@@ -201,6 +247,8 @@ static inline void _sampler()
 
     last_time = gettime();
 
+    microsecond_t next_census = 0;
+
     while (running)
     {
         microsecond_t now = gettime();
@@ -208,16 +256,34 @@ static inline void _sampler()
 
         if (memory)
         {
-            if (rss_tracker.check())
-                stack_stats.flush();
+            flush_memory_events();
+
+            if (heap_dump_requested.exchange(false))
+                dump_heap(std::cerr);
+
+            if (rss_tracker.check(now))
+                stack_stats.flush(rss_tracker.flushed(now));
+        }
+        else if (census)
+        {
+            // If a census could not be taken, e.g. because of a full
+            // collection, we wait for the next period rather than retrying at
+            // the next tick, as a census is expensive.
+            if (now >= next_census)
+            {
+                heap_census.update();
+                next_census = now + census * 1000000UL;
+            }
         }
         else
         {
             microsecond_t wall_time = now - last_time;
 
             for_each_interp([=](InterpreterInfo& interp) -> void {
-                for_each_thread(interp, [=](PyThreadState* tstate, ThreadInfo& thread) {
-                    auto sample_success = thread.sample(interp.id, tstate, wall_time);
+                auto for_each = native ? for_each_thread_native : for_each_thread;
+                for_each(interp, [=](PyThreadState* tstate, ThreadInfo& thread) {
+                    auto sample_success = thread.sample(
+                        interp.id, tstate, wall_time, interp.is_collecting(thread.tstate_addr));
                     if (!sample_success) {
                         // Silently skip sampling this thread
                     }
@@ -357,13 +423,16 @@ static PyObject* track_asyncio_loop(PyObject* Py_UNUSED(m), PyObject* args)
     if (!PyArg_ParseTuple(args, "lO", &thread_id, &loop))
         return NULL;
 
+    PyObject* ready = (loop != Py_None) ? LoopStats::find_ready_queue(loop) : NULL;
+
     {
         std::lock_guard<std::mutex> guard(thread_info_map_lock);
 
         if (thread_info_map.find(thread_id) != thread_info_map.end())
         {
-            thread_info_map.find(thread_id)->second->asyncio_loop =
-                (loop != Py_None) ? (uintptr_t)loop : 0;
+            auto& thread_info = thread_info_map.find(thread_id)->second;
+            thread_info->asyncio_loop = (loop != Py_None) ? (uintptr_t)loop : 0;
+            thread_info->loop_stats = LoopStats(ready);
         }
     }
 
@@ -404,22 +473,33 @@ static PyObject* track_greenlet(PyObject* Py_UNUSED(m), PyObject* args)
     }
     greenlet_name = *maybe_greenlet_name;
 
+    auto native_id = PyThread_get_thread_native_id();
+
+    // The replaced info, if any, is released after the lock.
+    GreenletInfo::Ptr old_greenlet_info = nullptr;
+
     {
         const std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
 
+        auto greenlet_info =
+            std::make_unique<GreenletInfo>(greenlet_id, frame, greenlet_name, native_id);
+
         auto entry = greenlet_info_map.find(greenlet_id);
         if (entry != greenlet_info_map.end())
+        {
             // Greenlet is already tracked so we update its info. This should
             // never happen, as a greenlet should be tracked only once, so we
             // use this as a safety net.
-            entry->second = std::make_unique<GreenletInfo>(greenlet_id, frame, greenlet_name);
+            remove_greenlet_leaf(greenlet_id);
+            old_greenlet_info = std::move(entry->second);
+            entry->second = std::move(greenlet_info);
+        }
         else
-            greenlet_info_map.emplace(
-                greenlet_id, std::make_unique<GreenletInfo>(greenlet_id, frame, greenlet_name));
+            greenlet_info_map.emplace(greenlet_id, std::move(greenlet_info));
 
-        // Update the thread map
-        auto native_id = PyThread_get_thread_native_id();
-        greenlet_thread_map[native_id] = greenlet_id;
+        // Greenlets that others are linked to are not leaves.
+        if (greenlet_parent_count.find(greenlet_id) == greenlet_parent_count.end())
+            add_greenlet_leaf(greenlet_id);
     }
 
     Py_RETURN_NONE;
@@ -432,12 +512,23 @@ static PyObject* untrack_greenlet(PyObject* Py_UNUSED(m), PyObject* args)
     if (!PyArg_ParseTuple(args, "l", &greenlet_id))
         return NULL;
 
+    // The info is released after the lock, as it holds a frame reference.
+    GreenletInfo::Ptr greenlet_info = nullptr;
+
     {
         const std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
 
-        greenlet_info_map.erase(greenlet_id);
-        greenlet_parent_map.erase(greenlet_id);
-        greenlet_thread_map.erase(greenlet_id);
+        remove_greenlet_leaf(greenlet_id);
+
+        auto entry = greenlet_info_map.find(greenlet_id);
+        if (entry != greenlet_info_map.end())
+        {
+            greenlet_info = std::move(entry->second);
+            greenlet_info_map.erase(entry);
+        }
+
+        unlink_greenlet(greenlet_id);
+        greenlet_parent_count.erase(greenlet_id);
     }
     Py_RETURN_NONE;
 }
@@ -453,7 +544,7 @@ static PyObject* link_greenlets(PyObject* Py_UNUSED(m), PyObject* args)
     {
         std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
 
-        greenlet_parent_map[child] = parent;
+        link_greenlet(child, parent);
     }
 
     Py_RETURN_NONE;
@@ -468,6 +559,8 @@ static PyObject* update_greenlet_frame(PyObject* Py_UNUSED(m), PyObject* args)
     if (!PyArg_ParseTuple(args, "lO", &greenlet_id, &frame))
         return NULL;
 
+    PyObject* old_frame = NULL;
+
     {
         std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
 
@@ -475,10 +568,126 @@ static PyObject* update_greenlet_frame(PyObject* Py_UNUSED(m), PyObject* args)
         if (entry != greenlet_info_map.end())
         {
             // Update the frame of the greenlet
-            entry->second->frame = frame;
+            old_frame = entry->second->set_frame(frame);
         }
     }
 
+    Py_XDECREF(old_frame);
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* init_greenlet_tracer(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    PyObject *track, *original;
+
+    if (!PyArg_ParseTuple(args, "OO", &track, &original))
+        return NULL;
+
+    // None unsets the corresponding hook.
+    PyObject* old_track = greenlet_track_callback;
+    PyObject* old_original = greenlet_original_tracer;
+
+    greenlet_track_callback = track != Py_None ? track : NULL;
+    greenlet_original_tracer = original != Py_None ? original : NULL;
+
+    Py_XINCREF(greenlet_track_callback);
+    Py_XINCREF(greenlet_original_tracer);
+    Py_XDECREF(old_track);
+    Py_XDECREF(old_original);
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static void trace_greenlet_switch(PyObject* origin, PyObject* target)
+{
+    // Greenlets are identified by their address, like gevent.thread.get_ident
+    // does.
+    auto origin_id = (GreenletInfo::ID)origin;
+    auto target_id = (GreenletInfo::ID)target;
+
+    bool origin_tracked, target_tracked;
+    {
+        std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
+
+        origin_tracked = greenlet_info_map.find(origin_id) != greenlet_info_map.end();
+        target_tracked = greenlet_info_map.find(target_id) != greenlet_info_map.end();
+    }
+
+    // Take this chance to track the greenlets that we haven't seen before,
+    // like the hub. Those that cannot be tracked are ignored.
+    for (auto [greenlet, tracked] : {std::make_pair(origin, origin_tracked),
+                                     std::make_pair(target, target_tracked)})
+    {
+        if (tracked || greenlet_track_callback == NULL)
+            continue;
+
+        PyObject* result = PyObject_CallFunctionObjArgs(greenlet_track_callback, greenlet, NULL);
+        if (result == NULL)
+            PyErr_Clear();
+        Py_XDECREF(result);
+    }
+
+    // The origin is being suspended, so we record its frame. If it has none,
+    // the greenlet is likely finished, and we use the sentinel to signal this.
+    static PyObject* gr_frame = PyUnicode_InternFromString("gr_frame");
+    PyObject* origin_frame = gr_frame != NULL ? PyObject_GetAttr(origin, gr_frame) : NULL;
+    if (origin_frame == NULL)
+        PyErr_Clear();
+    if (origin_frame == NULL || origin_frame == Py_None)
+    {
+        Py_INCREF(FRAME_NOT_SET);
+        Py_XSETREF(origin_frame, FRAME_NOT_SET);
+    }
+
+    PyObject *old_origin_frame = NULL, *old_target_frame = NULL;
+    {
+        std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
+
+        auto origin_entry = greenlet_info_map.find(origin_id);
+        if (origin_entry != greenlet_info_map.end())
+            old_origin_frame = origin_entry->second->set_frame(origin_frame);
+
+        // We don't want to wipe the frame of a parent greenlet because we need
+        // to unwind it. We definitely know it is still running so if we allow
+        // the tracer to set its tracked frame to None, we won't be able to
+        // unwind the full stack.
+        auto target_entry = greenlet_info_map.find(target_id);
+        if (target_entry != greenlet_info_map.end() &&
+            greenlet_parent_count.find(target_id) == greenlet_parent_count.end())
+            // The target is the running greenlet.
+            old_target_frame = target_entry->second->set_frame(Py_None);
+    }
+
+    Py_DECREF(origin_frame);
+    Py_XDECREF(old_origin_frame);
+    Py_XDECREF(old_target_frame);
+}
+
+// ----------------------------------------------------------------------------
+// The greenlet tracer, called by greenlet on every switch with the event name
+// and the (origin, target) pair. Since this is on the hot path of gevent
+// applications, we use the fast calling convention.
+static PyObject* greenlet_tracer(PyObject* Py_UNUSED(m), PyObject* const* args, Py_ssize_t nargs)
+{
+    if (nargs != 2)
+    {
+        PyErr_SetString(PyExc_TypeError, "greenlet_tracer expects 2 arguments");
+        return NULL;
+    }
+
+    PyObject *event = args[0], *event_args = args[1];
+
+    if (PyUnicode_Check(event) && PyTuple_Check(event_args) && PyTuple_GET_SIZE(event_args) == 2 &&
+        (PyUnicode_CompareWithASCIIString(event, "switch") == 0 ||
+         PyUnicode_CompareWithASCIIString(event, "throw") == 0))
+        trace_greenlet_switch(PyTuple_GET_ITEM(event_args, 0), PyTuple_GET_ITEM(event_args, 1));
+
+    if (greenlet_original_tracer != NULL)
+        return PyObject_CallFunctionObjArgs(greenlet_original_tracer, event, event_args, NULL);
+
     Py_RETURN_NONE;
 }
 
@@ -490,15 +699,262 @@ static PyObject* link_tasks(PyObject* Py_UNUSED(m), PyObject* args)
     if (!PyArg_ParseTuple(args, "OO", &parent, &child))
         return NULL;
 
+    task_link_map.link(parent, child);
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* link_current_task(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    PyObject *loop, *children;
+
+    if (!PyArg_ParseTuple(args, "OO", &loop, &children))
+        return NULL;
+
+    if (asyncio_current_tasks == NULL || loop == Py_None)
+        Py_RETURN_NONE;
+
+    // We hold the GIL, so we can look up the current task directly.
+    PyObject* parent = NULL;
+#if PY_VERSION_HEX >= 0x030e0000
+    // Native tasks track the current task in the thread state instead.
+    auto tstate = (_PyThreadStateImpl*)PyThreadState_Get();
+    if (tstate->asyncio_running_loop == loop)
+        parent = tstate->asyncio_running_task;
+    if (parent == NULL)
+#endif  // PY_VERSION_HEX >= 0x030e0000
+        parent = PyDict_GetItemWithError(asyncio_current_tasks, loop);
+    if (parent == NULL)
     {
-        std::lock_guard<std::mutex> guard(task_link_map_lock);
+        if (PyErr_Occurred())
+            return NULL;
 
-        task_link_map[child] = parent;
+        // Not called from within a task
+        Py_RETURN_NONE;
     }
 
+    PyObject* seq = PySequence_Fast(children, "children must be iterable");
+    if (seq == NULL)
+        return NULL;
+
+    task_link_map.link(parent, PySequence_Fast_ITEMS(seq), PySequence_Fast_GET_SIZE(seq));
+
+    Py_DECREF(seq);
+
     Py_RETURN_NONE;
 }
 
+// ----------------------------------------------------------------------------
+static PyObject* loop_stats(PyObject* Py_UNUSED(m), PyObject* Py_UNUSED(args))
+{
+    std::vector<std::pair<uintptr_t, LoopStats>> stats;
+
+    {
+        const std::lock_guard<std::mutex> guard(thread_info_map_lock);
+
+        for (auto& entry : thread_info_map)
+        {
+            auto& loop_stats = entry.second->loop_stats;
+            if (loop_stats.ready == NULL)
+                continue;
+
+            stats.emplace_back(entry.first, loop_stats);
+
+            // Peak values are reported since the last query.
+            loop_stats.reset();
+        }
+    }
+
+    // We build the result without holding the lock, as allocating Python
+    // objects might run arbitrary code.
+    PyObject* result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+
+    for (auto& [thread_id, loop_stats] : stats)
+    {
+        PyObject* key = PyLong_FromUnsignedLong(thread_id);
+        PyObject* value = Py_BuildValue(
+            "{s:n,s:n,s:d,s:d}", "depth", loop_stats.depth, "max_depth", loop_stats.max_depth,
+            "lag", loop_stats.lag / 1e6, "max_lag", loop_stats.max_lag / 1e6);
+
+        int error = (key == NULL || value == NULL || PyDict_SetItem(result, key, value));
+
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+
+        if (error)
+        {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+// Convert a stack into a tuple of (filename, name, line) tuples.
+static PyObject* stack_to_tuple(const std::vector<StackTable::Node>& frames)
+{
+    auto lookup = [](StringTable::Key key) -> const char* {
+        auto maybe_string = string_table.lookup(key);
+        return maybe_string ? (*maybe_string)->c_str() : "<unknown>";
+    };
+
+    PyObject* result = PyTuple_New(frames.size());
+    if (result == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        auto& frame = frames[i];
+        PyObject* item =
+            Py_BuildValue("(ssi)", lookup(frame.filename), lookup(frame.name), frame.line);
+        if (item == NULL)
+        {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(result, i, item);
+    }
+
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+// Convert a report into a dictionary that maps each stack to its stats.
+template <typename T, typename F>
+static PyObject* report_to_dict(const StackReport<T>& report, F to_value)
+{
+    PyObject* result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+
+    for (auto& [frames, stats] : report)
+    {
+        PyObject* key = stack_to_tuple(frames);
+        PyObject* value = to_value(stats);
+
+        int error = (key == NULL || value == NULL || PyDict_SetItem(result, key, value));
+
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+
+        if (error)
+        {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* heap_snapshot(PyObject* Py_UNUSED(m), PyObject* Py_UNUSED(args))
+{
+    if (!memory_ready)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Memory mode is not running");
+        return NULL;
+    }
+
+    return report_to_dict(take_heap_snapshot(), [](const HeapStats& stats) {
+        return Py_BuildValue("(nn)", stats.size, stats.count);
+    });
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* rss_growth(PyObject* Py_UNUSED(m), PyObject* Py_UNUSED(args))
+{
+    if (!memory_ready)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Memory mode is not running");
+        return NULL;
+    }
+
+    return report_to_dict(take_rss_attribution(),
+                          [](size_t size) { return PyLong_FromSize_t(size); });
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* lifetimes(PyObject* Py_UNUSED(m), PyObject* Py_UNUSED(args))
+{
+    if (!memory_ready)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Memory mode is not running");
+        return NULL;
+    }
+
+    return report_to_dict(take_lifetimes(), [](const LifetimeHistogram& histogram) -> PyObject* {
+        PyObject* counts = PyTuple_New(LIFETIME_BUCKETS);
+        if (counts == NULL)
+            return NULL;
+
+        for (size_t i = 0; i < LIFETIME_BUCKETS; i++)
+        {
+            PyObject* count = PyLong_FromSize_t(histogram.counts[i]);
+            if (count == NULL)
+            {
+                Py_DECREF(counts);
+                return NULL;
+            }
+            PyTuple_SET_ITEM(counts, i, count);
+        }
+
+        return counts;
+    });
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* type_census(PyObject* Py_UNUSED(m), PyObject* Py_UNUSED(args))
+{
+#ifdef Py_GIL_DISABLED
+    PyErr_SetString(PyExc_RuntimeError,
+                    "The heap census is not supported on free-threaded builds");
+    return NULL;
+#else
+    // With the GIL held, the GC lists cannot change while we read them.
+    std::unordered_map<std::string, CensusEntry> totals;
+
+    for_each_interp([&](InterpreterInfo& interp) {
+        Census census;
+        if (!HeapCensus::take(interp, census))
+            return;
+
+        for (auto& [name, entry] : census)
+        {
+            auto maybe_name = string_table.lookup(name);
+            auto& total = totals[maybe_name ? **maybe_name : "<unknown>"];
+            total.count += entry.count;
+            total.size += entry.size;
+        }
+    });
+
+    PyObject* result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+
+    for (auto& [name, entry] : totals)
+    {
+        PyObject* value = Py_BuildValue("(nn)", entry.count, entry.size);
+        int error = (value == NULL || PyDict_SetItemString(result, name.c_str(), value));
+
+        Py_XDECREF(value);
+
+        if (error)
+        {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+
+    return result;
+#endif  // Py_GIL_DISABLED
+}
+
 // ----------------------------------------------------------------------------
 static PyMethodDef echion_core_methods[] = {
     {"start", start, METH_NOARGS, "Start the stack sampler"},
@@ -512,17 +968,45 @@ static PyMethodDef echion_core_methods[] = {
      "Map the name of a task with its identifier"},
     {"init_asyncio", init_asyncio, METH_VARARGS, "Initialise asyncio tracking"},
     {"link_tasks", link_tasks, METH_VARARGS, "Link two tasks"},
+    {"link_current_task", link_current_task, METH_VARARGS,
+     "Link the current task of a loop to the given children"},
+    {"loop_stats", loop_stats, METH_NOARGS, "Get the ready queue statistics of the event loops"},
+    // Memory mode
+    {"heap_snapshot", heap_snapshot, METH_NOARGS,
+     "Get the live heap memory grouped by allocation stack"},
+    {"rss_growth", rss_growth, METH_NOARGS,
+     "Get the growth of the resident set size attributed to each allocation stack"},
+    {"lifetimes", lifetimes, METH_NOARGS,
+     "Get the histograms of the allocation lifetimes of each allocation stack"},
+    {"type_census", type_census, METH_NOARGS,
+     "Count the number and size of the GC-tracked objects by type"},
     // Greenlet support
     {"track_greenlet", track_greenlet, METH_VARARGS, "Map a greenlet with its identifier"},
     {"untrack_greenlet", untrack_greenlet, METH_VARARGS, "Untrack a terminated greenlet"},
     {"link_greenlets", link_greenlets, METH_VARARGS, "Link two greenlets"},
     {"update_greenlet_frame", update_greenlet_frame, METH_VARARGS,
      "Update the frame of a greenlet"},
+    {"init_greenlet_tracer", init_greenlet_tracer, METH_VARARGS,
+     "Set the greenlet tracking callback and the tracer to chain to"},
+    {"greenlet_tracer", (PyCFunction)(void (*)(void))greenlet_tracer, METH_FASTCALL,
+     "The greenlet switch tracer"},
     // Configuration interface
     {"set_interval", set_interval, METH_VARARGS, "Set the sampling interval"},
     {"set_cpu", set_cpu, METH_VARARGS, "Set whether to use CPU time instead of wall time"},
     {"set_memory", set_memory, METH_VARARGS, "Set whether to sample memory usage"},
+    {"set_memory_sampling_rate", set_memory_sampling_rate, METH_VARARGS,
+     "Set the mean number of bytes between sampled allocations"},
     {"set_native", set_native, METH_VARARGS, "Set whether to sample the native stacks"},
+    {"set_native_perf", set_native_perf, METH_VARARGS,
+     "Set whether to sample the native stacks with perf events"},
+    {"set_native_leaf", set_native_leaf, METH_VARARGS,
+     "Set the number of native frames to attach on top of the Python stacks"},
+    {"set_task_sample_size", set_task_sample_size, METH_VARARGS,
+     "Set the number of idle asyncio tasks to sample at each tick"},
+    {"set_idle", set_idle, METH_VARARGS, "Set whether to report idle event loops"},
+    {"set_gc", set_gc, METH_VARARGS, "Set whether to sample the garbage collector state"},
+    {"set_census", set_census, METH_VARARGS,
+     "Set the interval in seconds between censuses of the GC-tracked objects"},
     {"set_where", set_where, METH_VARARGS, "Set whether to use where mode"},
     {"set_pipe_name", set_pipe_name, METH_VARARGS, "Set the pipe name"},
     {"set_max_frames", set_max_frames, METH_VARARGS, "Set the max number of frames to unwind"},
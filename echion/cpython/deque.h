@@ -0,0 +1,34 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+// The layout of collections.deque objects, from Modules/_collectionsmodule.c.
+// We only need the leading fields, which have been stable across all the
+// supported versions.
+namespace deque_layout {
+// The number of items in each block of the deque
+inline constexpr Py_ssize_t BLOCKLEN = 64;
+}  // namespace deque_layout
+
+extern "C" {
+
+typedef struct DequeBlock
+{
+    struct DequeBlock* leftlink;
+    PyObject* data[deque_layout::BLOCKLEN];
+    struct DequeBlock* rightlink;
+} DequeBlock;
+
+typedef struct
+{
+    PyObject_VAR_HEAD DequeBlock* leftblock;
+    DequeBlock* rightblock;
+    Py_ssize_t leftindex;  /* 0 <= leftindex < BLOCKLEN */
+    Py_ssize_t rightindex; /* 0 <= rightindex < BLOCKLEN */
+} DequeObject;
+}
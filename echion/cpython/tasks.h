@@ -13,6 +13,10 @@
 #define Py_BUILD_CORE
 #if PY_VERSION_HEX >= 0x030d0000
 #include <opcode.h>
+#if PY_VERSION_HEX >= 0x030e0000
+#include <internal/pycore_llist.h>
+#include <internal/pycore_tstate.h>
+#endif  // PY_VERSION_HEX >= 0x030e0000
 #else
 #include <internal/pycore_opcode.h>
 #include <internal/pycore_frame.h>
@@ -35,7 +39,29 @@ typedef enum
     STATE_FINISHED
 } fut_state;
 
-#if PY_VERSION_HEX >= 0x030d0000
+#if PY_VERSION_HEX >= 0x030e0000
+#define FutureObj_HEAD(prefix)                                  \
+    PyObject_HEAD PyObject* prefix##_loop;                      \
+    PyObject* prefix##_callback0;                               \
+    PyObject* prefix##_context0;                                \
+    PyObject* prefix##_callbacks;                               \
+    PyObject* prefix##_exception;                               \
+    PyObject* prefix##_exception_tb;                            \
+    PyObject* prefix##_result;                                  \
+    PyObject* prefix##_source_tb;                               \
+    PyObject* prefix##_cancel_msg;                              \
+    PyObject* prefix##_cancelled_exc;                           \
+    PyObject* prefix##_awaited_by;                              \
+    fut_state prefix##_state;                                   \
+    char prefix##_is_task;                                      \
+    char prefix##_awaited_by_is_set;                            \
+    /* These bitfields need to be at the end of the struct      \
+       so that these and bitfields from TaskObj are contiguous. \
+    */                                                          \
+    unsigned prefix##_log_tb : 1;                               \
+    unsigned prefix##_blocking : 1;
+
+#elif PY_VERSION_HEX >= 0x030d0000
 #define FutureObj_HEAD(prefix)                                  \
     PyObject_HEAD PyObject* prefix##_loop;                      \
     PyObject* prefix##_callback0;                               \
@@ -128,7 +154,24 @@ typedef struct
     FutureObj_HEAD(future)
 } FutureObj;
 
-#if PY_VERSION_HEX >= 0x030d0000
+#if PY_VERSION_HEX >= 0x030e0000
+typedef struct
+{
+    FutureObj_HEAD(task);
+    unsigned task_must_cancel : 1;
+    unsigned task_log_destroy_pending : 1;
+    int task_num_cancels_requested;
+    PyObject* task_fut_waiter;
+    PyObject* task_coro;
+    PyObject* task_name;
+    PyObject* task_context;
+    struct llist_node task_node;
+#ifdef Py_GIL_DISABLED
+    uintptr_t task_tid;
+#endif
+} TaskObj;
+
+#elif PY_VERSION_HEX >= 0x030d0000
 typedef struct
 {
     FutureObj_HEAD(task);
@@ -199,11 +242,11 @@ inline PyObject* PyGen_yf(PyGenObject* gen, PyObject* frame_addr)
         if (frame.stacktop < 1 || frame.stacktop > (1 << 20))
             return NULL;
 
-        auto localsplus = std::make_unique<PyObject*[]>(frame.stacktop);
-        if (copy_generic(frame.localsplus, localsplus.get(), frame.stacktop * sizeof(PyObject*)))
+        // The value stack lives in the remote frame, so we copy the top of it
+        // from there rather than from our local copy of the frame.
+        auto localsplus = (PyObject**)((char*)frame_addr + offsetof(_PyInterpreterFrame, localsplus));
+        if (copy_type(localsplus + frame.stacktop - 1, yf))
             return NULL;
-
-        yf = localsplus[frame.stacktop - 1];
     }
 
     return yf;
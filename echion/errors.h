@@ -25,6 +25,8 @@ enum class ErrorKind {
     CpuTimeError,
     LocationError,
     RendererError,
+    SymbolError,
+    PerfError,
 };
 
 template <typename T>
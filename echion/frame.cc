@@ -2,6 +2,9 @@
 
 #include <echion/render.h>
 #include <echion/errors.h>
+#ifndef UNWIND_NATIVE_DISABLE
+#include <echion/symbols.h>
+#endif  // UNWIND_NATIVE_DISABLE
 
 // ----------------------------------------------------------------------------
 #if PY_VERSION_HEX >= 0x030b0000
@@ -106,16 +109,19 @@ Result<Frame::Ptr> Frame::create(PyCodeObject* code, int lasti)
 
 // ------------------------------------------------------------------------
 #ifndef UNWIND_NATIVE_DISABLE
-Result<Frame::Ptr> Frame::create(unw_cursor_t& cursor, unw_word_t pc)
+Result<Frame::Ptr> Frame::create_native(uintptr_t pc)
 {
-    auto filename = string_table.key(pc);
-
-    auto maybe_name = string_table.key(cursor);
-    if (!maybe_name) {
+    auto maybe_symbol = symbolizer.resolve(pc);
+    if (!maybe_symbol) {
         return ErrorKind::FrameError;
     }
 
-    return std::make_unique<Frame>(filename, *maybe_name);
+    auto& symbol = *maybe_symbol;
+    auto frame = std::make_unique<Frame>(symbol.module, symbol.name);
+    // For native frames, the line number is the offset within the module.
+    frame->location.line = static_cast<int>(symbol.offset);
+
+    return frame;
 }
 #endif  // UNWIND_NATIVE_DISABLE
 
@@ -449,33 +455,26 @@ Frame& Frame::get(PyObject* frame)
 
 // ----------------------------------------------------------------------------
 #ifndef UNWIND_NATIVE_DISABLE
-Result<std::reference_wrapper<Frame>> Frame::get(unw_cursor_t& cursor)
+Frame& Frame::get_native(uintptr_t pc)
 {
-    unw_word_t pc;
-    unw_get_reg(&cursor, UNW_REG_IP, &pc);
-    if (pc == 0) {
-        return ErrorKind::FrameError;
-    }
-
     uintptr_t frame_key = (uintptr_t)pc;
     auto maybe_frame = frame_cache->lookup(frame_key);
     if (maybe_frame) {
         return *maybe_frame;
     }
 
-    auto maybe_new_frame = Frame::create(cursor, pc);
-    if (!maybe_new_frame) {
-        return std::ref(UNKNOWN_FRAME);
-    }
-
-    auto frame = std::move(*maybe_new_frame);
+    // Addresses that we cannot resolve are cached too, so that we don't keep
+    // on trying to symbolize them on every sample.
+    auto maybe_new_frame = Frame::create_native(pc);
+    auto frame = maybe_new_frame ? std::move(*maybe_new_frame)
+                                 : std::make_unique<Frame>(StringTable::UNKNOWN);
     frame->cache_key = frame_key;
     auto& f = *frame;
     Renderer::get().frame(frame_key, frame->filename, frame->name, frame->location.line,
                             frame->location.line_end, frame->location.column,
                             frame->location.column_end);
     frame_cache->store(frame_key, std::move(frame));
-    return std::ref(f);
+    return f;
 }
 #endif  // UNWIND_NATIVE_DISABLE
 
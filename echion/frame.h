@@ -28,12 +28,6 @@
 #include <cstring>
 #include <functional>
 
-#ifndef UNWIND_NATIVE_DISABLE
-#include <cxxabi.h>
-#define UNW_LOCAL_ONLY
-#include <libunwind.h>
-#endif  // UNWIND_NATIVE_DISABLE
-
 #include <echion/cache.h>
 #include <echion/mojo.h>
 #if PY_VERSION_HEX >= 0x030b0000
@@ -73,7 +67,7 @@ public:
     Frame(PyObject* frame);
     [[nodiscard]] static Result<Frame::Ptr> create(PyCodeObject* code, int lasti);
 #ifndef UNWIND_NATIVE_DISABLE
-    [[nodiscard]] static Result<Frame::Ptr> create(unw_cursor_t& cursor, unw_word_t pc);
+    [[nodiscard]] static Result<Frame::Ptr> create_native(uintptr_t pc);
 #endif  // UNWIND_NATIVE_DISABLE
 
 #if PY_VERSION_HEX >= 0x030b0000
@@ -85,7 +79,7 @@ public:
     [[nodiscard]] static Result<std::reference_wrapper<Frame>> get(PyCodeObject* code_addr, int lasti);
     static Frame& get(PyObject* frame);
 #ifndef UNWIND_NATIVE_DISABLE
-    [[nodiscard]] static Result<std::reference_wrapper<Frame>> get(unw_cursor_t& cursor);
+    static Frame& get_native(uintptr_t pc);
 #endif  // UNWIND_NATIVE_DISABLE
     static Frame& get(StringTable::Key name);
 
@@ -7,6 +7,8 @@
 #include <Python.h>
 #define Py_BUILD_CORE
 
+#include <unordered_map>
+#include <unordered_set>
 
 #include <echion/stacks.h>
 #include <echion/strings.h>
@@ -24,26 +26,57 @@ public:
 
     ID greenlet_id = 0;
     StringTable::Key name;
+
+    // The native thread that the greenlet belongs to.
+    unsigned long native_id = 0;
+
+    // A strong reference to the frame of the greenlet, or Py_None if it is
+    // running, or FRAME_NOT_SET. Greenlet infos are created, updated and
+    // destroyed with the GIL held.
     PyObject* frame = NULL;
 
-    GreenletInfo(ID id, PyObject* frame, StringTable::Key name)
-        : greenlet_id(id), frame(frame), name(name)
+    GreenletInfo(ID id, PyObject* frame, StringTable::Key name, unsigned long native_id)
+        : greenlet_id(id), name(name), native_id(native_id), frame(frame)
+    {
+        Py_XINCREF(frame);
+    }
+
+    ~GreenletInfo()
+    {
+        Py_XDECREF(frame);
+    }
+
+    // Replace the frame of the greenlet. The reference to the old frame is
+    // returned to the caller, who must release it without holding the
+    // greenlet info map lock, as that might run arbitrary code.
+    [[nodiscard]] PyObject* set_frame(PyObject* new_frame)
     {
+        Py_XINCREF(new_frame);
+        auto old_frame = frame;
+        frame = new_frame;
+        return old_frame;
     }
 
-    int unwind(PyObject*, PyThreadState*, FrameStack&);
+    static int unwind(PyObject*, StringTable::Key, PyThreadState*, FrameStack&);
 };
 
 // ----------------------------------------------------------------------------
 
-inline int GreenletInfo::unwind(PyObject* frame, PyThreadState* tstate, FrameStack& stack)
+inline int GreenletInfo::unwind(PyObject* frame, StringTable::Key name, PyThreadState* tstate,
+                                FrameStack& stack)
 {
     PyObject* frame_addr = NULL;
 #if PY_VERSION_HEX >= 0x030d0000
-    frame_addr =
-        frame == Py_None
-            ? (PyObject*)tstate->current_frame
-            : reinterpret_cast<PyObject*>(reinterpret_cast<struct _frame*>(frame)->f_frame);
+    if (frame == Py_None)
+    {
+        frame_addr = (PyObject*)tstate->current_frame;
+    }
+    else
+    {
+        // The frame object might be released while we unwind, so we copy it.
+        if (copy_type(&reinterpret_cast<struct _frame*>(frame)->f_frame, frame_addr))
+            return 0;
+    }
 #elif PY_VERSION_HEX >= 0x030b0000
     if (frame == Py_None)
     {
@@ -57,7 +90,9 @@ inline int GreenletInfo::unwind(PyObject* frame, PyThreadState* tstate, FrameSta
     }
     else
     {
-        frame_addr = reinterpret_cast<PyObject*>(reinterpret_cast<struct _frame*>(frame)->f_frame);
+        // The frame object might be released while we unwind, so we copy it.
+        if (copy_type(&reinterpret_cast<struct _frame*>(frame)->f_frame, frame_addr))
+            return 0;
     }
 
 #else  // Python < 3.11
@@ -83,12 +118,90 @@ inline std::unordered_map<GreenletInfo::ID, GreenletInfo::Ptr>& greenlet_info_ma
 inline std::unordered_map<GreenletInfo::ID, GreenletInfo::ID>& greenlet_parent_map =
     *(new std::unordered_map<GreenletInfo::ID, GreenletInfo::ID>());
 
-// maps threads to any currently active greenlets
-inline std::unordered_map<uintptr_t, GreenletInfo::ID>& greenlet_thread_map =
-    *(new std::unordered_map<uintptr_t, GreenletInfo::ID>());
+// counts the greenlets linked to each parent
+inline std::unordered_map<GreenletInfo::ID, size_t>& greenlet_parent_count =
+    *(new std::unordered_map<GreenletInfo::ID, size_t>());
+
+// maps native threads to their leaf greenlets, i.e. those that no other
+// greenlet is linked to
+inline std::unordered_map<unsigned long, std::unordered_set<GreenletInfo::ID>>&
+    greenlet_thread_leaves =
+        *(new std::unordered_map<unsigned long, std::unordered_set<GreenletInfo::ID>>());
 
 inline std::mutex greenlet_info_map_lock;
 
+// ----------------------------------------------------------------------------
+// The helpers below keep the leaf index up to date. They must be called with
+// greenlet_info_map_lock held.
+
+inline void add_greenlet_leaf(GreenletInfo::ID greenlet_id)
+{
+    auto entry = greenlet_info_map.find(greenlet_id);
+    if (entry == greenlet_info_map.end())
+        return;
+
+    greenlet_thread_leaves[entry->second->native_id].insert(greenlet_id);
+}
+
+// ----------------------------------------------------------------------------
+inline void remove_greenlet_leaf(GreenletInfo::ID greenlet_id)
+{
+    auto entry = greenlet_info_map.find(greenlet_id);
+    if (entry == greenlet_info_map.end())
+        return;
+
+    auto leaves = greenlet_thread_leaves.find(entry->second->native_id);
+    if (leaves == greenlet_thread_leaves.end())
+        return;
+
+    leaves->second.erase(greenlet_id);
+    if (leaves->second.empty())
+        greenlet_thread_leaves.erase(leaves);
+}
+
+// ----------------------------------------------------------------------------
+inline void unlink_greenlet(GreenletInfo::ID child)
+{
+    auto entry = greenlet_parent_map.find(child);
+    if (entry == greenlet_parent_map.end())
+        return;
+
+    auto parent = entry->second;
+    greenlet_parent_map.erase(entry);
+
+    // The parent becomes a leaf again once it has no more children.
+    auto count = greenlet_parent_count.find(parent);
+    if (count != greenlet_parent_count.end() && --count->second == 0)
+    {
+        greenlet_parent_count.erase(count);
+        add_greenlet_leaf(parent);
+    }
+}
+
+// ----------------------------------------------------------------------------
+inline void link_greenlet(GreenletInfo::ID child, GreenletInfo::ID parent)
+{
+    auto entry = greenlet_parent_map.find(child);
+    if (entry != greenlet_parent_map.end())
+    {
+        if (entry->second == parent)
+            return;
+
+        // The greenlet is now linked to a different parent.
+        unlink_greenlet(child);
+    }
+
+    greenlet_parent_map[child] = parent;
+    if (greenlet_parent_count[parent]++ == 0)
+        remove_greenlet_leaf(parent);
+}
+
+// The hooks of the greenlet tracer: the callable used to track the greenlets
+// that we see for the first time, and the tracer that was installed before
+// ours, if any.
+inline PyObject* greenlet_track_callback = NULL;
+inline PyObject* greenlet_original_tracer = NULL;
+
 // ----------------------------------------------------------------------------
 
 inline std::vector<std::unique_ptr<StackInfo>> current_greenlets;
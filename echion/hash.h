@@ -0,0 +1,51 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+// Fast 64-bit hashing of pairs of frame keys, like the edges of the stack trie.
+// The mixing function is the folded 128-bit multiplication used by wyhash,
+// which is both cheap and of high quality.
+
+namespace echion_hash {
+
+inline constexpr uint64_t P0 = 0xa0761d6478bd642fULL;
+inline constexpr uint64_t P1 = 0xe7037ed1a0b428dbULL;
+inline constexpr uint64_t P2 = 0x8ebc6af09c88c6e3ULL;
+inline constexpr uint64_t P3 = 0x589965cc75374cc3ULL;
+
+// ----------------------------------------------------------------------------
+// Multiply the two words and fold the 128-bit result into 64 bits.
+static inline uint64_t mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+    // Portable version for 32-bit targets.
+    uint64_t ha = a >> 32, la = static_cast<uint32_t>(a);
+    uint64_t hb = b >> 32, lb = static_cast<uint32_t>(b);
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+
+    uint64_t t = ll + (hl << 32);
+    uint64_t carry = t < ll;
+    uint64_t lo = t + (lh << 32);
+    carry += lo < t;
+    uint64_t hi = hh + (hl >> 32) + (lh >> 32) + carry;
+
+    return lo ^ hi;
+#endif
+}
+
+}  // namespace echion_hash
+
+// ----------------------------------------------------------------------------
+static inline uint64_t hash_pair(uint64_t a, uint64_t b)
+{
+    return echion_hash::mum(a ^ echion_hash::P0, b ^ echion_hash::P1);
+}
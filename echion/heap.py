@@ -0,0 +1,57 @@
+# This file is part of "echion" which is released under MIT.
+#
+# Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+import typing as t
+
+from echion.core import heap_snapshot
+from echion.core import lifetimes as _lifetimes
+from echion.core import rss_growth
+
+
+Frame = t.Tuple[str, str, int]  # (filename, name, line)
+Stack = t.Tuple[Frame, ...]
+Snapshot = t.Dict[Stack, t.Tuple[int, int]]  # stack -> (size, count)
+
+
+def snapshot() -> Snapshot:
+    """Get the live heap memory, in bytes and number of allocations, grouped
+    by allocation stack. With allocation sampling, the sizes are estimates of
+    the actual ones, while the numbers of allocations are those of the sampled
+    allocations. This requires memory mode."""
+    return heap_snapshot()
+
+
+def rss() -> t.Dict[Stack, int]:
+    """Get the growth of the resident set size, in bytes, attributed to each
+    allocation stack. Whenever the memory stats are flushed, the growth since
+    the previous flush is split among the stacks that retained memory in the
+    meantime, in proportion to the number of bytes that they retained. This
+    requires memory mode."""
+    return rss_growth()
+
+
+def lifetimes() -> t.Dict[Stack, t.Tuple[int, ...]]:
+    """Get the histogram of the lifetimes of the freed allocations of each
+    allocation stack. Bucket 0 counts the allocations that lived less than a
+    microsecond, and bucket i > 0 those that lived between 2**(i - 1) and
+    2**i microseconds. The last bucket also counts all the longer lifetimes.
+    Allocations that have not been freed yet are not counted. This requires
+    memory mode."""
+    return _lifetimes()
+
+
+def diff(before: Snapshot, after: Snapshot) -> t.List[t.Tuple[Stack, int, int]]:
+    """Compute the change in live bytes and number of allocations for each
+    stack between two snapshots, sorted by the largest growth first. Stacks
+    that have not changed are omitted."""
+    result = []
+
+    for stack in before.keys() | after.keys():
+        size_before, count_before = before.get(stack, (0, 0))
+        size_after, count_after = after.get(stack, (0, 0))
+
+        if size_after != size_before or count_after != count_before:
+            result.append((stack, size_after - size_before, count_after - count_before))
+
+    return sorted(result, key=lambda _: _[1], reverse=True)
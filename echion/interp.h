@@ -17,6 +17,7 @@
 
 #include <functional>
 
+#include <echion/config.h>
 #include <echion/state.h>
 #include <echion/vm.h>
 
@@ -25,10 +26,56 @@ class InterpreterInfo
 {
 public:
     int64_t id = 0;
+    void* addr = NULL;
     void* tstate_head = NULL;
     void* next = NULL;
+
+    // Whether the garbage collector is running, and the thread state that
+    // last held the GIL, i.e. the one that is running the collection.
+    int gc_collecting = 0;
+    void* gil_holder = NULL;
+
+    // ------------------------------------------------------------------------
+    bool is_collecting(void* tstate_addr) const
+    {
+        return gc_collecting && tstate_addr == gil_holder;
+    }
 };
 
+// ----------------------------------------------------------------------------
+static void read_gc_state(char* interp_addr, InterpreterInfo& interpreter_info)
+{
+    interpreter_info.gc_collecting = 0;
+    interpreter_info.gil_holder = NULL;
+
+#if PY_VERSION_HEX >= 0x03090000
+    if (copy_type(interp_addr + offsetof(PyInterpreterState, gc.collecting),
+                  interpreter_info.gc_collecting))
+        return;
+#else
+    (void)interp_addr;
+    if (copy_type(&runtime->gc.collecting, interpreter_info.gc_collecting))
+        return;
+#endif
+
+    if (!interpreter_info.gc_collecting)
+        return;
+
+    // The last GIL holder is stored as an atomic address, which has the same
+    // layout as a plain pointer.
+#if PY_VERSION_HEX >= 0x030c0000
+    struct _gil_runtime_state* gil = NULL;
+    if (copy_type(interp_addr + offsetof(PyInterpreterState, ceval.gil), gil) || gil == NULL)
+        return;
+
+    void* last_holder_addr = (char*)gil + offsetof(struct _gil_runtime_state, last_holder);
+#else
+    void* last_holder_addr = &runtime->ceval.gil.last_holder;
+#endif
+    if (copy_generic(last_holder_addr, &interpreter_info.gil_holder, sizeof(void*)))
+        interpreter_info.gil_holder = NULL;
+}
+
 static void for_each_interp(std::function<void(InterpreterInfo& interp)> callback)
 {
     InterpreterInfo interpreter_info = {0};
@@ -39,6 +86,8 @@ static void for_each_interp(std::function<void(InterpreterInfo& interp)> callbac
         if (copy_type(interp_addr + offsetof(PyInterpreterState, id), interpreter_info.id))
             continue;
 
+        interpreter_info.addr = interp_addr;
+
             #if PY_VERSION_HEX >= 0x030b0000
         if (copy_type(interp_addr + offsetof(PyInterpreterState, threads.head), interpreter_info.tstate_head))
 #else
@@ -49,6 +98,9 @@ static void for_each_interp(std::function<void(InterpreterInfo& interp)> callbac
         if (copy_type(interp_addr + offsetof(PyInterpreterState, next), interpreter_info.next))
             continue;
 
+        if (gc)
+            read_gc_state(interp_addr, interpreter_info);
+
         callback(interpreter_info);
     };
 }
@@ -0,0 +1,117 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <echion/cpython/deque.h>
+#include <echion/timing.h>
+#include <echion/vm.h>
+
+// ----------------------------------------------------------------------------
+// Statistics about the ready queue of an asyncio event loop, i.e. the deque of
+// the callbacks that are due to run at the next iteration of the loop. They
+// are updated at each sample. Handles carry no timestamps, so the lag is
+// estimated as the time for which the same handle has been seen at the head of
+// the queue. This is a lower bound, accurate to the sampling interval.
+class LoopStats
+{
+public:
+    // The ready queue of the loop, if we could find one.
+    PyObject* ready = NULL;
+
+    // The length of the ready queue and the lag, as of the last sample, and
+    // their peak values since the last reset.
+    Py_ssize_t depth = 0;
+    Py_ssize_t max_depth = 0;
+    microsecond_t lag = 0;
+    microsecond_t max_lag = 0;
+
+    // ------------------------------------------------------------------------
+    LoopStats() = default;
+    LoopStats(PyObject* ready) : ready(ready) {}
+
+    void update(microsecond_t now);
+
+    // ------------------------------------------------------------------------
+    void reset()
+    {
+        max_depth = depth;
+        max_lag = lag;
+    }
+
+    // ------------------------------------------------------------------------
+    // Find the ready queue of the given loop. This must be called with the GIL
+    // held, and returns NULL if the loop does not have one, like in the case of
+    // third-party loops.
+    static PyObject* find_ready_queue(PyObject* loop)
+    {
+        PyObject* ready = PyObject_GetAttrString(loop, "_ready");
+        if (ready == NULL)
+        {
+            PyErr_Clear();
+            return NULL;
+        }
+
+        // The loop holds a reference to its ready queue for its whole lifetime.
+        Py_DECREF(ready);
+
+        return strcmp(Py_TYPE(ready)->tp_name, "collections.deque") == 0 ? ready : NULL;
+    }
+
+private:
+    // The head of the queue, as last seen, and when we first saw it.
+    PyObject* head = NULL;
+    DequeBlock* head_block = NULL;
+    Py_ssize_t head_index = 0;
+    microsecond_t head_since = 0;
+};
+
+// ----------------------------------------------------------------------------
+inline void LoopStats::update(microsecond_t now)
+{
+    DequeObject deque;
+    if (ready == NULL || copy_type(ready, deque))
+        return;
+
+    depth = deque.ob_base.ob_size;
+    if (depth <= 0)
+    {
+        depth = 0;
+        lag = 0;
+        head = NULL;
+    }
+    else
+    {
+        if (deque.leftindex < 0 || deque.leftindex >= deque_layout::BLOCKLEN)
+            return;
+
+        PyObject* current = NULL;
+        if (copy_type((char*)deque.leftblock + offsetof(DequeBlock, data) +
+                          deque.leftindex * sizeof(PyObject*),
+                      current))
+            return;
+
+        // Handles can be recycled at the same address once they have run, so
+        // we also check that the head of the queue has not moved.
+        if (current != head || deque.leftblock != head_block || deque.leftindex != head_index)
+        {
+            head = current;
+            head_block = deque.leftblock;
+            head_index = deque.leftindex;
+            head_since = now;
+        }
+
+        lag = now - head_since;
+    }
+
+    max_depth = std::max(max_depth, depth);
+    max_lag = std::max(max_lag, lag);
+}
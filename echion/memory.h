@@ -6,49 +6,189 @@
 
 #include <Python.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
 #include <optional>
+#include <ostream>
+#include <random>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
+#include <fcntl.h>
 #include <sys/resource.h>
+#include <unistd.h>
+#if defined PL_DARWIN
+#include <mach/mach.h>
+#endif
 
 #include <echion/config.h>
 #include <echion/interp.h>
 #include <echion/mojo.h>
 #include <echion/stacks.h>
+#include <echion/state.h>
 #include <echion/threads.h>
+#include <echion/timing.h>
 
 // ----------------------------------------------------------------------------
+// The memory stats are flushed when the resident set size has changed by at
+// least this many bytes since the last flush, or when this much time has
+// passed, whichever comes first.
+inline constexpr ssize_t RSS_FLUSH_DELTA = 1 << 20;          // 1 MiB
+inline constexpr microsecond_t RSS_FLUSH_INTERVAL = 1000000;  // 1 s
+
+// ----------------------------------------------------------------------------
+// Tracker of the current resident set size of the process. On Linux, this is
+// read from /proc/self/statm, which we keep open to make each reading a single
+// pread. The peak RSS from getrusage is only used as a fallback, as it never
+// goes down and therefore cannot tell when memory is returned to the system.
 class ResidentMemoryTracker
 {
 public:
-    size_t size;
+    size_t size = 0;
 
     // ------------------------------------------------------------------------
-    ResidentMemoryTracker()
+    // Start tracking from the current RSS. This also needs to be called after
+    // a fork, as /proc/self is resolved when the file is opened.
+    void reset()
     {
+#if defined PL_LINUX
+        if (fd >= 0)
+            close(fd);
+        fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+#endif
+
         update();
+
+        flushed_size = size;
+        flushed_at = gettime();
     }
 
     // ------------------------------------------------------------------------
-    bool inline check()
+    // Update the RSS and tell whether the memory stats are due for a flush.
+    bool inline check(microsecond_t now)
     {
-        size_t old_size = size;
         update();
-        return size != old_size;
+
+        ssize_t delta = static_cast<ssize_t>(size) - static_cast<ssize_t>(flushed_size);
+
+        return delta >= RSS_FLUSH_DELTA || delta <= -RSS_FLUSH_DELTA ||
+               now - flushed_at >= RSS_FLUSH_INTERVAL;
+    }
+
+    // ------------------------------------------------------------------------
+    // Mark the stats as flushed and return the RSS growth since the previous
+    // flush.
+    ssize_t inline flushed(microsecond_t now)
+    {
+        ssize_t growth = static_cast<ssize_t>(size) - static_cast<ssize_t>(flushed_size);
+
+        flushed_size = size;
+        flushed_at = now;
+
+        return growth;
     }
 
-private:
     // ------------------------------------------------------------------------
     void inline update()
     {
+#if defined PL_LINUX
+        if (fd >= 0)
+        {
+            // The second field is the number of resident pages.
+            char buffer[128];
+            auto n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+            if (n > 0)
+            {
+                buffer[n] = '\0';
+
+                unsigned long pages = 0;
+                char* resident = strchr(buffer, ' ');
+                if (resident != NULL && sscanf(resident, "%lu", &pages) == 1)
+                {
+                    size = pages * page_size;
+                    return;
+                }
+            }
+        }
+#elif defined PL_DARWIN
+        mach_task_basic_info_data_t info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) ==
+            KERN_SUCCESS)
+        {
+            size = info.resident_size;
+            return;
+        }
+#endif
+
         struct rusage usage;
         getrusage(RUSAGE_SELF, &usage);
-        size = usage.ru_maxrss;
+#if defined PL_DARWIN
+        size = usage.ru_maxrss;  // Already in bytes
+#else
+        size = usage.ru_maxrss << 10;
+#endif
     }
+
+private:
+#if defined PL_LINUX
+    int fd = -1;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+#endif
+
+    size_t flushed_size = 0;
+    microsecond_t flushed_at = 0;
 };
 
 inline ResidentMemoryTracker rss_tracker;
 
+// ----------------------------------------------------------------------------
+// Histogram of the lifetimes of the allocations, in microseconds, with buckets
+// of exponentially increasing width. Bucket 0 counts the allocations that have
+// lived less than 1 us and bucket i > 0 those that have lived in the interval
+// [2^(i-1), 2^i) us. The last bucket also counts all the longer lifetimes.
+inline constexpr size_t LIFETIME_BUCKETS = 32;
+
+struct LifetimeHistogram
+{
+    std::array<size_t, LIFETIME_BUCKETS> counts = {};
+
+    // ------------------------------------------------------------------------
+    void add(microsecond_t lifetime)
+    {
+        size_t bucket = 0;
+        for (; lifetime > 0 && bucket < LIFETIME_BUCKETS - 1; lifetime >>= 1)
+            bucket++;
+
+        counts[bucket]++;
+    }
+
+    // ------------------------------------------------------------------------
+    size_t total() const
+    {
+        size_t total = 0;
+        for (auto count : counts)
+            total += count;
+        return total;
+    }
+
+    // ------------------------------------------------------------------------
+    LifetimeHistogram& operator+=(const LifetimeHistogram& other)
+    {
+        for (size_t i = 0; i < LIFETIME_BUCKETS; i++)
+            counts[i] += other.counts[i];
+        return *this;
+    }
+};
+
 // ----------------------------------------------------------------------------
 
 class MemoryStats
@@ -57,13 +197,19 @@ public:
     int64_t iid;
     std::string thread_name;
 
-    FrameStack::Key stack;
+    StackTable::Key stack;
 
     size_t count;
     ssize_t size;
 
+    // The share of the RSS growth that has been attributed to the stack.
+    size_t rss = 0;
+
+    // The lifetimes of the freed allocations since the tracking started.
+    LifetimeHistogram lifetimes;
+
     // ------------------------------------------------------------------------
-    MemoryStats(int iid, std::string thread_name, FrameStack::Key stack, size_t count, size_t size)
+    MemoryStats(int iid, std::string thread_name, StackTable::Key stack, size_t count, size_t size)
         : iid(iid), thread_name(thread_name), stack(stack), count(count), size(size)
     {
     }
@@ -73,17 +219,97 @@ public:
     {
         Renderer::get().render_stack_begin(pid, iid, thread_name);
 
-        stack_table.retrieve(stack).render();
+        stack_table.render(stack);
 
         Renderer::get().render_stack_end(MetricType::Memory, size);
     }
 };
 
+// ----------------------------------------------------------------------------
+struct HeapStats
+{
+    size_t size = 0;
+    size_t count = 0;
+
+    // ------------------------------------------------------------------------
+    HeapStats& operator+=(const HeapStats& other)
+    {
+        size += other.size;
+        count += other.count;
+        return *this;
+    }
+};
+
 // ----------------------------------------------------------------------------
 struct MemoryTableEntry
 {
-    FrameStack::Key stack;
+    StackTable::Key stack;
     size_t size;
+    microsecond_t time;  // When the allocation was made
+};
+
+// ----------------------------------------------------------------------------
+// A counting Bloom filter of the tracked addresses. With sampling, most
+// deallocations are of memory that we are not tracking, and the filter lets
+// them through without recording an event. Addresses are added as soon as the
+// allocation is recorded, and counters that saturate are never decremented,
+// so there are no false negatives.
+class AddressFilter
+{
+public:
+    // ------------------------------------------------------------------------
+    void add(void* address)
+    {
+        auto [i, j] = slots(address);
+        for (auto k : {i, j})
+        {
+            auto count = counters[k].load(std::memory_order_relaxed);
+            while (count != UINT8_MAX &&
+                   !counters[k].compare_exchange_weak(count, count + 1, std::memory_order_relaxed))
+                ;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    void remove(void* address)
+    {
+        auto [i, j] = slots(address);
+        for (auto k : {i, j})
+        {
+            auto count = counters[k].load(std::memory_order_relaxed);
+            while (count != 0 && count != UINT8_MAX &&
+                   !counters[k].compare_exchange_weak(count, count - 1, std::memory_order_relaxed))
+                ;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    bool maybe_contains(void* address) const
+    {
+        auto [i, j] = slots(address);
+        return counters[i].load(std::memory_order_relaxed) != 0 &&
+               counters[j].load(std::memory_order_relaxed) != 0;
+    }
+
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        for (auto& counter : counters)
+            counter.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int BITS = 20;
+
+    std::atomic<uint8_t> counters[1 << BITS] = {};
+
+    // ------------------------------------------------------------------------
+    static std::pair<size_t, size_t> slots(void* address)
+    {
+        // Fibonacci hashing of the address, split into two indices.
+        uint64_t hash = reinterpret_cast<uintptr_t>(address) * 0x9E3779B97F4A7C15ULL;
+        return {hash >> (64 - BITS), (hash >> (32 - BITS)) & ((1 << BITS) - 1)};
+    }
 };
 
 // ----------------------------------------------------------------------------
@@ -91,11 +317,46 @@ class MemoryTable : public std::unordered_map<void*, MemoryTableEntry>
 {
 public:
     // ------------------------------------------------------------------------
-    void link(void* address, FrameStack::Key stack, size_t size)
+    // Announce that an allocation at the given address is about to be linked.
+    void expect(void* address)
+    {
+        filter.add(address);
+    }
+
+    // ------------------------------------------------------------------------
+    // Whether the given address might have been linked. This can be called
+    // from any thread without taking the lock.
+    bool maybe_linked(void* address) const
+    {
+        return filter.maybe_contains(address);
+    }
+
+    // ------------------------------------------------------------------------
+    void link(void* address, StackTable::Key stack, size_t size, microsecond_t time)
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
-        this->emplace(address, MemoryTableEntry{stack, size});
+        if (!this->emplace(address, MemoryTableEntry{stack, size, time}).second)
+            // We missed the deallocation of the previous entry.
+            filter.remove(address);
+    }
+
+    // ------------------------------------------------------------------------
+    // Aggregate the live allocations by stack.
+    std::unordered_map<StackTable::Key, HeapStats> live()
+    {
+        std::unordered_map<StackTable::Key, HeapStats> result;
+
+        std::lock_guard<std::mutex> lock(this->lock);
+
+        for (auto& [_, entry] : *this)
+        {
+            auto& stats = result[entry.stack];
+            stats.size += entry.size;
+            stats.count++;
+        }
+
+        return result;
     }
 
     // ------------------------------------------------------------------------
@@ -109,22 +370,84 @@ public:
         {
             auto entry = it->second;
             erase(it);
+            filter.remove(address);
             return {entry};
         }
 
         return {};
     }
 
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(this->lock);
+
+        std::unordered_map<void*, MemoryTableEntry>::clear();
+        filter.clear();
+    }
+
 private:
     std::mutex lock;
+    AddressFilter filter;
+};
+
+// ----------------------------------------------------------------------------
+// Byte-based Poisson sampling of the allocations, like in tcmalloc. Each thread
+// draws the number of bytes to allocate until the next sample from an
+// exponential distribution with the configured mean, so that an allocation of
+// n bytes is sampled with probability 1 - exp(-n / rate). Sampled allocations
+// are then scaled by the inverse of this probability, which makes the totals
+// unbiased.
+class AllocationSampler
+{
+public:
+    // ------------------------------------------------------------------------
+    // Return whether the allocation of the given size should be recorded and,
+    // if so, update the size with the scaled one.
+    bool sample(size_t& size)
+    {
+        if (rate != memory_sampling_rate)
+        {
+            // The rate has changed since the last draw.
+            rate = memory_sampling_rate;
+            bytes_until_sample = next();
+        }
+
+        if (size < bytes_until_sample)
+        {
+            bytes_until_sample -= size;
+            return false;
+        }
+
+        bytes_until_sample = next();
+
+        double probability = -std::expm1(-static_cast<double>(size) / rate);
+        size = static_cast<size_t>(std::llround(size / probability));
+
+        return true;
+    }
+
+private:
+    unsigned int rate = 0;
+    size_t bytes_until_sample = 0;
+    std::minstd_rand rng{std::random_device{}()};
+
+    // ------------------------------------------------------------------------
+    size_t next()
+    {
+        return static_cast<size_t>(std::exponential_distribution<double>(1.0 / rate)(rng)) + 1;
+    }
 };
 
+inline thread_local AllocationSampler allocation_sampler;
+
 // ----------------------------------------------------------------------------
 class StackStats
 {
 public:
     // ------------------------------------------------------------------------
-    void inline update(PyThreadState* tstate, FrameStack::Key stack, size_t size)
+    void inline update(int64_t iid, const std::string& thread_name, StackTable::Key stack,
+                       size_t size)
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
@@ -132,17 +455,9 @@ public:
 
         if (stack_entry == map.end())
         {
-            if (tstate == NULL)
-                // Invalid thread state, nothing we can do.
-                return;
-
-            std::lock_guard<std::mutex> ti_lock(thread_info_map_lock);
-
             // Map the memory address with the stack so that we can account for
             // the deallocations.
-            map.emplace(stack,
-                        MemoryStats(tstate->interp->id, thread_info_map[tstate->thread_id]->name,
-                                    stack, 1, size));
+            map.emplace(stack, MemoryStats(iid, thread_name, stack, 1, size));
         }
         else
         {
@@ -152,21 +467,41 @@ public:
     }
 
     // ------------------------------------------------------------------------
-    void inline update(MemoryTableEntry& entry)
+    void inline update(MemoryTableEntry& entry, microsecond_t lifetime)
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
         auto stack_entry = map.find(entry.stack);
 
         if (stack_entry != map.end())
+        {
             stack_entry->second.size -= entry.size;
+            stack_entry->second.lifetimes.add(lifetime);
+        }
     }
 
     // ------------------------------------------------------------------------
-    void flush()
+    // Emit the stats collected since the last flush. The growth of the RSS in
+    // the meantime, if any, is attributed to the stacks that have retained
+    // memory, in proportion to the number of bytes that they retained.
+    void flush(ssize_t rss_growth = 0)
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
+        if (rss_growth > 0)
+        {
+            size_t total = 0;
+            for (auto& entry : map)
+                if (entry.second.size > 0)
+                    total += entry.second.size;
+
+            if (total > 0)
+                for (auto& entry : map)
+                    if (entry.second.size > 0)
+                        entry.second.rss += static_cast<size_t>(
+                            static_cast<double>(rss_growth) * entry.second.size / total);
+        }
+
         for (auto& entry : map)
         {
             // Emit non-trivial stack stats only
@@ -179,6 +514,34 @@ public:
         }
     }
 
+    // ------------------------------------------------------------------------
+    // Get the RSS growth attributed to each stack so far.
+    std::vector<std::pair<StackTable::Key, size_t>> rss()
+    {
+        std::lock_guard<std::mutex> lock(this->lock);
+
+        std::vector<std::pair<StackTable::Key, size_t>> result;
+        for (auto& [stack, stats] : map)
+            if (stats.rss > 0)
+                result.emplace_back(stack, stats.rss);
+
+        return result;
+    }
+
+    // ------------------------------------------------------------------------
+    // Get the lifetime histograms of the stacks that have freed memory.
+    std::vector<std::pair<StackTable::Key, LifetimeHistogram>> lifetimes()
+    {
+        std::lock_guard<std::mutex> lock(this->lock);
+
+        std::vector<std::pair<StackTable::Key, LifetimeHistogram>> result;
+        for (auto& [stack, stats] : map)
+            if (stats.lifetimes.total() > 0)
+                result.emplace_back(stack, stats.lifetimes);
+
+        return result;
+    }
+
     // ------------------------------------------------------------------------
     void clear()
     {
@@ -189,7 +552,7 @@ public:
 
 private:
     std::mutex lock;
-    std::unordered_map<FrameStack::Key, MemoryStats> map;
+    std::unordered_map<StackTable::Key, MemoryStats> map;
 };
 
 // ----------------------------------------------------------------------------
@@ -200,12 +563,172 @@ private:
 inline auto& stack_stats = *(new StackStats());
 inline auto& memory_table = *(new MemoryTable());
 
+// ----------------------------------------------------------------------------
+// An allocation or deallocation event. Deallocations have no stack. The name of
+// the allocating thread is taken when the event is recorded, as the thread
+// might have exited by the time the event is applied.
+struct MemoryEvent
+{
+    uint64_t seq;
+    void* address;
+    size_t size;
+    FrameStack::Ptr stack;
+    int64_t iid;
+    std::string thread_name;
+    microsecond_t time;
+};
+
+// ----------------------------------------------------------------------------
+struct MemoryEventBuffer
+{
+    std::mutex lock;
+    std::vector<MemoryEvent> events;
+};
+
+// ----------------------------------------------------------------------------
+// The memory events are recorded in per-thread buffers, so that allocating
+// threads only ever take their own, uncontended, lock. The sampler thread
+// periodically drains the buffers and applies the events to the tables in the
+// order given by a global sequence number, so that the deallocation of memory
+// allocated by another thread is always applied after the allocation.
+class MemoryEvents
+{
+public:
+    // ------------------------------------------------------------------------
+    void record(void* address, size_t size, FrameStack::Ptr stack, int64_t iid,
+                const std::string& thread_name)
+    {
+        auto& buffer = local_buffer();
+        auto time = gettime();
+
+        // The sequence number is taken with the buffer lock held, so that the
+        // drain can tell which events have been pushed already.
+        std::lock_guard<std::mutex> guard(buffer.lock);
+
+        buffer.events.push_back({seq.fetch_add(1, std::memory_order_relaxed), address, size,
+                                 std::move(stack), iid, thread_name, time});
+    }
+
+    // ------------------------------------------------------------------------
+    // Take all the events recorded so far, sorted by sequence number.
+    std::vector<MemoryEvent> drain()
+    {
+        std::vector<MemoryEvent> result;
+
+        // Any event with a sequence number below the watermark has been
+        // pushed by the time we get hold of the lock of its buffer. Events
+        // past the watermark are left for the next drain, as those that
+        // precede them might not have been pushed yet.
+        auto watermark = seq.load(std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            for (auto& [_, buffer] : buffers)
+            {
+                std::lock_guard<std::mutex> buffer_guard(buffer->lock);
+
+                auto& events = buffer->events;
+                auto end = std::find_if(events.begin(), events.end(), [=](const MemoryEvent& e) {
+                    return e.seq >= watermark;
+                });
+
+                std::move(events.begin(), end, std::back_inserter(result));
+                events.erase(events.begin(), end);
+            }
+        }
+
+        std::sort(result.begin(), result.end(),
+                  [](const MemoryEvent& a, const MemoryEvent& b) { return a.seq < b.seq; });
+
+        return result;
+    }
+
+    // ------------------------------------------------------------------------
+    // Drop all the events recorded so far. The buffers themselves are never
+    // freed, as the threads cache them and might be recording an event into
+    // them right now, e.g. from the allocators of the raw domain, which are
+    // called without the GIL.
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (auto& [_, buffer] : buffers)
+        {
+            std::lock_guard<std::mutex> buffer_guard(buffer->lock);
+
+            buffer->events.clear();
+        }
+    }
+
+private:
+    std::atomic<uint64_t> seq{0};
+
+    // Buffers are owned by the native thread IDs, rather than the threads, as
+    // we have no way of knowing when a thread exits. A new thread that reuses
+    // the ID of a finished one simply takes over its buffer.
+    std::mutex lock;
+    std::unordered_map<unsigned long, std::unique_ptr<MemoryEventBuffer>> buffers;
+
+    // ------------------------------------------------------------------------
+    MemoryEventBuffer& local_buffer()
+    {
+        static thread_local MemoryEventBuffer* cache = nullptr;
+
+        if (cache == nullptr)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            auto& buffer = buffers[PyThread_get_thread_native_id()];
+            if (buffer == nullptr)
+                buffer = std::make_unique<MemoryEventBuffer>();
+
+            cache = buffer.get();
+        }
+
+        return *cache;
+    }
+};
+
+inline auto& memory_events = *(new MemoryEvents());
+
+// ----------------------------------------------------------------------------
+// The name of the calling thread, or an empty string if the thread is not
+// being tracked.
+static inline const std::string& current_thread_name(uintptr_t thread_id)
+{
+    static thread_local std::string name;
+
+    // Threads are only tracked once they have started, so we keep looking
+    // until we find the calling one.
+    if (name.empty())
+    {
+        std::lock_guard<std::mutex> guard(thread_info_map_lock);
+
+        auto thread_info = thread_info_map.find(thread_id);
+        if (thread_info != thread_info_map.end())
+            name = thread_info->second->name;
+    }
+
+    return name;
+}
+
 // ----------------------------------------------------------------------------
 static inline void general_alloc(void* address, size_t size)
 {
-    auto stack = std::make_unique<FrameStack>();
+    if (memory_sampling_rate && !allocation_sampler.sample(size))
+        return;
+
     auto* tstate = PyThreadState_Get();  // DEV: This should be called with the GIL held
 
+    // We cannot attribute the allocations of threads that we don't know about,
+    // so we don't track them at all.
+    auto& thread_name = current_thread_name(tstate->thread_id);
+    if (thread_name.empty())
+        return;
+
+    auto stack = std::make_unique<FrameStack>();
+
     // DEV: We unwind the stack by reading the data out of live Python objects.
     // This works under the assumption that the objects/data structures we are
     // interested in belong to the thread whose stack we are unwinding.
@@ -214,24 +737,157 @@ static inline void general_alloc(void* address, size_t size)
     // in-line with the allocation within the calling thread.
     unwind_python_stack_unsafe(tstate, *stack);
 
-    // Store the stack and get its key for reference
-    // TODO: Handle collision exception
-    auto stack_key = stack_table.store(std::move(stack));
-
-    // Link the memory address with the stack
-    memory_table.link(address, stack_key, size);
+    // Let the deallocation of this address through the filter
+    memory_table.expect(address);
 
-    // Update the stack stats
-    stack_stats.update(tstate, stack_key, size);
+    memory_events.record(address, size, std::move(stack), tstate->interp->id, thread_name);
 }
 
 // ----------------------------------------------------------------------------
 static inline void general_free(void* address)
 {
-    // Retrieve the stack that made the allocation
-    if (auto entry = memory_table.unlink(address))
-        // Update the stack stats
-        stack_stats.update(*entry);
+    // Most deallocations are of memory that we are not tracking
+    if (memory_table.maybe_linked(address))
+        memory_events.record(address, 0, nullptr, 0, std::string());
+}
+
+// ----------------------------------------------------------------------------
+// Apply the recorded memory events to the tables. This normally runs on the
+// sampler thread, but it can also be called on demand, e.g. to take a heap
+// snapshot, so batches are applied one at a time to preserve their order.
+inline std::mutex memory_events_flush_lock;
+
+static inline void flush_memory_events()
+{
+    std::lock_guard<std::mutex> guard(memory_events_flush_lock);
+
+    for (auto& event : memory_events.drain())
+    {
+        if (event.stack != nullptr)
+        {
+            // Store the stack and get its key for reference
+            auto stack_key = stack_table.store(*event.stack);
+
+            // Link the memory address with the stack
+            memory_table.link(event.address, stack_key, event.size, event.time);
+
+            // Update the stack stats
+            stack_stats.update(event.iid, event.thread_name, stack_key, event.size);
+        }
+        // Retrieve the stack that made the allocation
+        else if (auto entry = memory_table.unlink(event.address))
+        {
+            // Update the stack stats
+            stack_stats.update(*entry, event.time > entry->time ? event.time - entry->time : 0);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Group the given stats by stack and sort them in descending order. Stacks are
+// told apart by the source locations of their frames, so different call sites
+// on the same line are reported together.
+template <typename T>
+using StackReport = std::vector<std::pair<std::vector<StackTable::Node>, T>>;
+
+template <typename Stats, typename Size>
+static StackReport<typename Stats::value_type::second_type> group_by_location(Stats stats,
+                                                                              Size size)
+{
+    using T = typename Stats::value_type::second_type;
+    using Location = std::tuple<StringTable::Key, StringTable::Key, int>;
+
+    std::map<std::vector<Location>, std::pair<StackTable::Key, T>> stacks;
+
+    for (auto& [stack, value] : stats)
+    {
+        std::vector<Location> locations;
+        for (auto& frame : stack_table.retrieve(stack))
+            locations.emplace_back(frame.filename, frame.name, frame.line);
+
+        stacks.try_emplace(std::move(locations), stack, T()).first->second.second += value;
+    }
+
+    StackReport<T> report;
+    for (auto& [_, entry] : stacks)
+        report.emplace_back(stack_table.retrieve(entry.first), entry.second);
+
+    std::sort(report.begin(), report.end(),
+              [=](const auto& a, const auto& b) { return size(a.second) > size(b.second); });
+
+    return report;
+}
+
+// ----------------------------------------------------------------------------
+// Take a snapshot of the live heap, that is the memory that has been allocated
+// and not freed since the tracking started, grouped by allocation stack.
+using HeapSnapshot = StackReport<HeapStats>;
+
+static inline HeapSnapshot take_heap_snapshot()
+{
+    flush_memory_events();
+
+    return group_by_location(memory_table.live(), [](const HeapStats& s) { return s.size; });
+}
+
+// ----------------------------------------------------------------------------
+// Get the growth of the resident set size attributed to each allocation stack.
+using RssAttribution = StackReport<size_t>;
+
+static inline RssAttribution take_rss_attribution()
+{
+    return group_by_location(stack_stats.rss(), [](size_t s) { return s; });
+}
+
+// ----------------------------------------------------------------------------
+// Get the lifetime histograms of the freed allocations of each stack, with the
+// stacks that have freed the most allocations first.
+using LifetimeReport = StackReport<LifetimeHistogram>;
+
+static inline LifetimeReport take_lifetimes()
+{
+    flush_memory_events();
+
+    return group_by_location(stack_stats.lifetimes(),
+                             [](const LifetimeHistogram& h) { return h.total(); });
+}
+
+// ----------------------------------------------------------------------------
+// Write a report of the largest live allocation stacks to the given stream.
+static void dump_heap(std::ostream& stream, size_t top = 20)
+{
+    auto snapshot = take_heap_snapshot();
+
+    size_t total_size = 0, total_count = 0;
+    for (auto& [_, stats] : snapshot)
+    {
+        total_size += stats.size;
+        total_count += stats.count;
+    }
+
+    auto lookup = [](StringTable::Key key) -> std::string {
+        auto maybe_string = string_table.lookup(key);
+        return maybe_string ? **maybe_string : "<unknown>";
+    };
+
+    rss_tracker.update();
+
+    stream << "\r🐴 Echion heap snapshot: " << total_size << " bytes in " << total_count
+           << " allocations, " << rss_tracker.size << " bytes resident" << std::endl;
+
+    for (size_t i = 0; i < snapshot.size() && i < top; i++)
+    {
+        auto& [stack, stats] = snapshot[i];
+
+        stream << std::endl
+               << "    " << stats.size << " bytes in " << stats.count << " allocations" << std::endl;
+
+        for (auto& frame : stack)
+            stream << "        " << lookup(frame.name) << " (" << lookup(frame.filename) << ":"
+                   << frame.line << ")" << std::endl;
+    }
+
+    stream << std::endl;
 }
 
 // ----------------------------------------------------------------------------
@@ -306,6 +962,10 @@ inline PyMemAllocatorEx echion_allocator = {NULL, echion_malloc, echion_calloc,
 // ----------------------------------------------------------------------------
 static void setup_memory()
 {
+    // Drop the events of the threads that were still in the allocators when
+    // memory mode was last torn down.
+    memory_events.clear();
+
     for (int i = 0; i < ALLOC_DOMAIN_COUNT; i++)
     {
         // Save the original allocators
@@ -315,18 +975,27 @@ static void setup_memory()
         echion_allocator.ctx = (void*)&original_allocators[i];
         PyMem_SetAllocator(static_cast<PyMemAllocatorDomain>(i), &echion_allocator);
     }
+
+    rss_tracker.reset();
+
+    memory_ready.store(true);
 }
 
 // ----------------------------------------------------------------------------
 static void teardown_memory()
 {
+    memory_ready.store(false);
+
     // Restore the original allocators
     for (int i = 0; i < ALLOC_DOMAIN_COUNT; i++)
         PyMem_SetAllocator(static_cast<PyMemAllocatorDomain>(i), &original_allocators[i]);
 
-    stack_stats.flush();
+    flush_memory_events();
+    rss_tracker.update();
+    stack_stats.flush(rss_tracker.flushed(gettime()));
 
     stack_stats.clear();
     stack_table.clear();
     memory_table.clear();
+    memory_events.clear();
 }
@@ -10,7 +10,10 @@
 #include <dictobject.h>
 #include <setobject.h>
 
-#include <memory>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
 
 #if PY_VERSION_HEX >= 0x030b0000
 #define Py_BUILD_CORE
@@ -50,55 +53,85 @@ typedef struct _dictkeysobject
 } PyDictKeysObject;
 
 typedef PyObject* PyDictValues;
+
+#define DKIX_EMPTY (-1)
 #endif
 
-#include <unordered_set>
+#ifndef PERTURB_SHIFT
+#define PERTURB_SHIFT 5
+#endif
 
 #include <echion/vm.h>
 
-class MirrorObject
-{
-public:
-    [[nodiscard]] inline Result<PyObject*> reflect()
-    {
-        if (reflected == NULL)
-            return ErrorKind::MirrorError;
+// The remote hash tables are read in windows of this many entries, so that
+// large tables can be walked with bounded memory.
+static constexpr size_t MIRROR_WINDOW_SIZE = 512;
 
-        return reflected;
-    }
-
-protected:
-    MirrorObject(std::unique_ptr<char[]> data, PyObject* reflected) : data(std::move(data)), reflected(reflected) {}
-
-    std::unique_ptr<char[]> data = nullptr;
-    PyObject* reflected = NULL;
-};
+// ----------------------------------------------------------------------------
+// The hash of objects that use the default hash function. This only depends on
+// the object address, so we can compute it without touching the object.
+inline Py_hash_t pointer_hash(PyObject* obj)
+{
+#if PY_VERSION_HEX >= 0x030d0000
+    return Py_HashPointer(obj);
+#else
+    return _Py_HashPointer(obj);
+#endif
+}
 
 // ----------------------------------------------------------------------------
-class MirrorDict : public MirrorObject
+class MirrorDict
 {
 public:
     [[nodiscard]] static inline Result<MirrorDict> create(PyObject* dict_addr);
 
-    [[nodiscard]] Result<PyObject*> get_item(PyObject* key)
-    {
-        auto maybe_reflected = reflect();
-        if (!maybe_reflected) {
-            return maybe_reflected;
-        }
+    // Look up the value for the given key, by identity, or NULL if there is
+    // none. Only the slots on the probe sequence of the key are read, provided
+    // that the key uses the default hash function. Otherwise we fall back to a
+    // scan of the entries.
+    [[nodiscard]] Result<PyObject*> get_item(PyObject* key);
 
-        return PyDict_GetItem(reflected, key);
-    }
+    // Stream through the live entries of the remote dictionary.
+    [[nodiscard]] Result<void> for_each(std::function<void(PyObject*, PyObject*)> callback);
 
 private:
-    MirrorDict(PyDictObject dict, std::unique_ptr<char[]> data, PyObject* reflected) : MirrorObject(std::move(data), reflected), dict(dict) {}
+    MirrorDict(PyDictObject dict, size_t size, size_t index_size, Py_ssize_t nentries, bool unicode)
+        : dict(dict), size(size), index_size(index_size), nentries(nentries), unicode(unicode)
+    {
+    }
+
     PyDictObject dict;
+
+    // The layout of the remote keys object
+    size_t size;
+    size_t index_size;
+    Py_ssize_t nentries;
+    bool unicode;
+
+    // ------------------------------------------------------------------------
+    char* entries_addr() const
+    {
+        return (char*)dict.ma_keys + offsetof(PyDictKeysObject, dk_indices) + size * index_size;
+    }
+
+    // ------------------------------------------------------------------------
+    PyObject** values_addr() const
+    {
+#if PY_VERSION_HEX >= 0x030b0000
+        return (PyObject**)((char*)dict.ma_values + offsetof(PyDictValues, values));
+#else
+        return (PyObject**)dict.ma_values;
+#endif
+    }
+
+    [[nodiscard]] Result<PyObject*> value_at(Py_ssize_t ix, PyObject* entry_value);
+    [[nodiscard]] Result<Py_ssize_t> index_at(size_t slot);
 };
 
+// ----------------------------------------------------------------------------
 [[nodiscard]] inline Result<MirrorDict> MirrorDict::create(PyObject* dict_addr)
 {
     PyDictObject dict;
-
     if (copy_type(dict_addr, dict)) {
         return ErrorKind::MirrorError;
     }
@@ -108,63 +141,211 @@ private:
         return ErrorKind::MirrorError;
     }
 
-    // Compute the full dictionary data size
 #if PY_VERSION_HEX >= 0x030b0000
-    size_t entry_size =
-        keys.dk_kind == DICT_KEYS_UNICODE ? sizeof(PyDictUnicodeEntry) : sizeof(PyDictKeyEntry);
-    size_t keys_size = sizeof(PyDictKeysObject) + (1 << keys.dk_log2_index_bytes) +
-                       (keys.dk_nentries * entry_size);
+    size_t size = (size_t)1 << keys.dk_log2_size;
+    size_t index_size = ((size_t)1 << keys.dk_log2_index_bytes) >> keys.dk_log2_size;
+    bool unicode = keys.dk_kind != DICT_KEYS_GENERAL;
 #else
-    size_t entry_size = sizeof(PyDictKeyEntry);
-    size_t keys_size = sizeof(PyDictKeysObject) + (keys.dk_size * sizeof(Py_ssize_t)) +
-                       (keys.dk_nentries * entry_size);
+    size_t size = keys.dk_size;
+    size_t index_size = size <= 0xff ? 1 : size <= 0xffff ? 2 : size <= 0xffffffff ? 4 : 8;
+    bool unicode = false;
 #endif
-    size_t values_size = dict.ma_values != NULL ? keys.dk_nentries * sizeof(PyObject*) : 0;
 
-    // Allocate the buffer
-    ssize_t data_size = keys_size + (keys.dk_nentries * entry_size) + values_size;
-    if (data_size < 0 || data_size > (1 << 20)) {
+    // Sanity-check the table layout, in case we have read inconsistent data.
+    if (size == 0 || (size & (size - 1)) || keys.dk_nentries < 0 ||
+        (size_t)keys.dk_nentries > size) {
         return ErrorKind::MirrorError;
     }
 
-    auto data = std::make_unique<char[]>(data_size);
+    return MirrorDict(dict, size, index_size, keys.dk_nentries, unicode);
+}
 
-    // Copy the key data and update the pointer
-    if (copy_generic(dict.ma_keys, data.get(), keys_size)) {
+// ----------------------------------------------------------------------------
+inline Result<Py_ssize_t> MirrorDict::index_at(size_t slot)
+{
+    auto addr = (char*)dict.ma_keys + offsetof(PyDictKeysObject, dk_indices);
+
+    switch (index_size)
+    {
+    case 1: {
+        int8_t ix;
+        if (copy_type(addr + slot, ix))
+            return ErrorKind::MirrorError;
+        return ix;
+    }
+    case 2: {
+        int16_t ix;
+        if (copy_type(addr + slot * 2, ix))
+            return ErrorKind::MirrorError;
+        return ix;
+    }
+    case 4: {
+        int32_t ix;
+        if (copy_type(addr + slot * 4, ix))
+            return ErrorKind::MirrorError;
+        return ix;
+    }
+    case 8: {
+        int64_t ix;
+        if (copy_type(addr + slot * 8, ix))
+            return ErrorKind::MirrorError;
+        return ix;
+    }
+    default:
         return ErrorKind::MirrorError;
     }
+}
 
-    dict.ma_keys = (PyDictKeysObject*)data.get();
+// ----------------------------------------------------------------------------
+inline Result<PyObject*> MirrorDict::value_at(Py_ssize_t ix, PyObject* entry_value)
+{
+    if (dict.ma_values == NULL)
+        return entry_value;
+
+    // Split table
+    PyObject* value;
+    if (copy_type(values_addr() + ix, value))
+        return ErrorKind::MirrorError;
 
-    if (dict.ma_values != NULL)
+    return value;
+}
+
+// ----------------------------------------------------------------------------
+inline Result<PyObject*> MirrorDict::get_item(PyObject* key)
+{
+    PyTypeObject* type;
+    hashfunc tp_hash;
+    if (copy_type(&key->ob_type, type) || copy_type(&type->tp_hash, tp_hash))
+        return ErrorKind::MirrorError;
+
+    if (tp_hash == PyBaseObject_Type.tp_hash)
     {
-        // Copy the value data and update the pointer
-        char* values_addr = data.get() + keys_size;
-        if (copy_generic(dict.ma_values, keys_size, values_size)) {
-            return ErrorKind::MirrorError;
+        // Keys with the default hash never end up in tables with unicode keys.
+        if (unicode)
+            return (PyObject*)NULL;
+
+        auto hash = pointer_hash(key);
+        size_t mask = size - 1;
+        size_t slot = (size_t)hash & mask;
+        size_t perturb = (size_t)hash;
+
+        // Bound the number of probes, in case the table changes under our feet.
+        for (size_t probes = 0; probes <= mask; probes++)
+        {
+            auto maybe_ix = index_at(slot);
+            if (!maybe_ix) {
+                return ErrorKind::MirrorError;
+            }
+
+            auto ix = *maybe_ix;
+            if (ix == DKIX_EMPTY)
+                // The end of the probe sequence, so the key is not in the table.
+                return (PyObject*)NULL;
+
+            if (ix >= 0)
+            {
+                if (ix >= nentries)
+                    return ErrorKind::MirrorError;
+
+                PyDictKeyEntry entry;
+                if (copy_type((PyDictKeyEntry*)entries_addr() + ix, entry))
+                    return ErrorKind::MirrorError;
+
+                if (entry.me_key == key)
+                    return value_at(ix, entry.me_value);
+            }
+
+            perturb >>= PERTURB_SHIFT;
+            slot = mask & (slot * 5 + perturb + 1);
         }
 
-        dict.ma_values = (PyDictValues*)values_addr;
+        // Every table has empty slots, so we must have read inconsistent data.
+        return ErrorKind::MirrorError;
     }
 
-    auto reflected = (PyObject*)&dict;
-    return MirrorDict(dict, std::move(data), reflected);
+    // The key has a custom hash, which we cannot compute, so we look for it
+    // among all the entries.
+    PyObject* value = NULL;
+    auto for_each_success = for_each([key, &value](PyObject* k, PyObject* v) {
+        if (k == key)
+            value = v;
+    });
+    if (!for_each_success) {
+        return ErrorKind::MirrorError;
+    }
+
+    return value;
 }
 
 // ----------------------------------------------------------------------------
-class MirrorSet : public MirrorObject
+inline Result<void> MirrorDict::for_each(std::function<void(PyObject*, PyObject*)> callback)
+{
+    auto count_entries = (size_t)nentries;
+
+#if PY_VERSION_HEX >= 0x030b0000
+    if (unicode)
+    {
+        std::array<PyDictUnicodeEntry, MIRROR_WINDOW_SIZE> window;
+        for (size_t start = 0; start < count_entries; start += MIRROR_WINDOW_SIZE)
+        {
+            size_t count = std::min(MIRROR_WINDOW_SIZE, count_entries - start);
+            if (copy_generic((PyDictUnicodeEntry*)entries_addr() + start, window.data(),
+                             count * sizeof(PyDictUnicodeEntry)))
+                return ErrorKind::MirrorError;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (window[i].me_key == NULL)
+                    continue;
+
+                auto maybe_value = value_at(start + i, window[i].me_value);
+                if (maybe_value && *maybe_value != NULL)
+                    callback(window[i].me_key, *maybe_value);
+            }
+        }
+
+        return Result<void>::ok();
+    }
+#endif
+
+    std::array<PyDictKeyEntry, MIRROR_WINDOW_SIZE> window;
+    for (size_t start = 0; start < count_entries; start += MIRROR_WINDOW_SIZE)
+    {
+        size_t count = std::min(MIRROR_WINDOW_SIZE, count_entries - start);
+        if (copy_generic((PyDictKeyEntry*)entries_addr() + start, window.data(),
+                         count * sizeof(PyDictKeyEntry)))
+            return ErrorKind::MirrorError;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (window[i].me_key == NULL)
+                continue;
+
+            auto maybe_value = value_at(start + i, window[i].me_value);
+            if (maybe_value && *maybe_value != NULL)
+                callback(window[i].me_key, *maybe_value);
+        }
+    }
+
+    return Result<void>::ok();
+}
+
+// ----------------------------------------------------------------------------
+class MirrorSet
 {
 public:
     [[nodiscard]] inline static Result<MirrorSet> create(PyObject*);
-    [[nodiscard]] Result<std::unordered_set<PyObject*>> as_unordered_set();
+
+    // Stream through the live keys of the remote set.
+    [[nodiscard]] Result<void> for_each(std::function<void(PyObject*)> callback);
 
 private:
-    MirrorSet(size_t size, PySetObject set, std::unique_ptr<char[]> data, PyObject* reflected) : MirrorObject(std::move(data), reflected), size(size), set(set) {}
+    MirrorSet(PySetObject set) : set(set) {}
 
-    size_t size;
     PySetObject set;
 };
 
+// ----------------------------------------------------------------------------
 [[nodiscard]] inline Result<MirrorSet> MirrorSet::create(PyObject* set_addr)
 {
     PySetObject set;
@@ -173,37 +354,41 @@ private:
         return ErrorKind::MirrorError;
     }
 
-    auto size = set.mask + 1;
-    ssize_t table_size = size * sizeof(setentry);
-    if (table_size < 0 || table_size > (1 << 20)) {
-        return ErrorKind::MirrorError;
-    }
-
-    auto data = std::make_unique<char[]>(table_size);
-    if (copy_generic(set.table, data.get(), table_size)) {
+    // Sanity-check the table layout, in case we have read inconsistent data.
+    size_t size = (size_t)set.mask + 1;
+    if (set.mask < 0 || (size & (size - 1)) || set.used < 0 || set.used > set.fill ||
+        (size_t)set.fill > size) {
         return ErrorKind::MirrorError;
     }
 
-    set.table = (setentry*)data.get();
-
-    auto reflected = (PyObject*)&set;
-    return MirrorSet(size, set, std::move(data), reflected);
+    return MirrorSet(set);
 }
 
-[[nodiscard]] inline Result<std::unordered_set<PyObject*>> MirrorSet::as_unordered_set()
+// ----------------------------------------------------------------------------
+[[nodiscard]] inline Result<void> MirrorSet::for_each(std::function<void(PyObject*)> callback)
 {
-    if (data == nullptr) {
-        return ErrorKind::MirrorError;
-    }
+    size_t size = (size_t)set.mask + 1;
+    Py_ssize_t remaining = set.used;
 
-    std::unordered_set<PyObject*> uset;
-
-    for (size_t i = 0; i < size; i++)
+    std::array<setentry, MIRROR_WINDOW_SIZE> window;
+    for (size_t start = 0; start < size && remaining > 0; start += MIRROR_WINDOW_SIZE)
     {
-        auto entry = set.table[i];
-        if (entry.key != NULL)
-            uset.insert(entry.key);
+        size_t count = std::min(MIRROR_WINDOW_SIZE, size - start);
+        if (copy_generic(set.table + start, window.data(), count * sizeof(setentry))) {
+            return ErrorKind::MirrorError;
+        }
+
+        for (size_t i = 0; i < count && remaining > 0; i++)
+        {
+            // Deleted entries point to a dummy key and have a hash of -1.
+            auto& entry = window[i];
+            if (entry.key == NULL || entry.hash == -1)
+                continue;
+
+            remaining--;
+            callback(entry.key);
+        }
     }
 
-    return uset;
+    return Result<void>::ok();
 }
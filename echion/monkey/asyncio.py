@@ -1,5 +1,9 @@
+import asyncio
 import sys
 import typing as t
+from asyncio import coroutines
+from asyncio import events
+from asyncio import futures
 from asyncio import tasks
 from asyncio.events import BaseDefaultEventLoopPolicy
 from functools import wraps
@@ -27,14 +31,73 @@ _gather = tasks._GatheringFuture.__init__  # type: ignore[attr-defined]
 @wraps(_gather)
 def gather(self, children, *, loop):
     # Link the parent gathering task to the gathered children
-    parent = tasks.current_task(loop)
+    echion.link_current_task(loop, children)
 
-    assert parent is not None
+    return _gather(self, children, loop=loop)
 
-    for child in children:
-        echion.link_tasks(parent, child)
 
-    return _gather(self, children, loop=loop)
+# -----------------------------------------------------------------------------
+
+_wait = tasks._wait  # type: ignore[attr-defined]
+
+
+@wraps(_wait)
+def wait(fs, timeout, return_when, loop):
+    # Link the waiting task to the awaited futures
+    echion.link_current_task(loop, fs)
+
+    return _wait(fs, timeout, return_when, loop)
+
+
+# -----------------------------------------------------------------------------
+
+_as_completed = tasks.as_completed
+
+
+@wraps(_as_completed)
+def as_completed(fs, *args, **kwargs):
+    if not (futures.isfuture(fs) or coroutines.iscoroutine(fs)):
+        # Link the current task to the futures that are already scheduled. We
+        # materialise the iterable as it might be a one-shot iterator.
+        fs = set(fs)
+        echion.link_current_task(
+            events._get_running_loop(), [f for f in fs if futures.isfuture(f)]
+        )
+
+    return _as_completed(fs, *args, **kwargs)
+
+
+# -----------------------------------------------------------------------------
+
+_shield = tasks.shield
+
+
+@wraps(_shield)
+def shield(arg, *args, **kwargs):
+    # Link the shielding task to the shielded one
+    inner = tasks.ensure_future(arg, loop=kwargs.get("loop"))
+    echion.link_current_task(events._get_running_loop(), (inner,))
+
+    return _shield(inner, *args, **kwargs)
+
+
+# -----------------------------------------------------------------------------
+
+if sys.hexversion >= 0x030B0000:
+    from asyncio.taskgroups import TaskGroup
+
+    _create_task = TaskGroup.create_task
+
+    @wraps(_create_task)
+    def create_task(self, *args, **kwargs):
+        task = _create_task(self, *args, **kwargs)
+
+        # Link the task that owns the group to the new task
+        parent = self._parent_task
+        if parent is not None:
+            echion.link_tasks(parent, task)
+
+        return task
 
 
 # -----------------------------------------------------------------------------
@@ -43,11 +106,21 @@ def gather(self, children, *, loop):
 def patch():
     BaseDefaultEventLoopPolicy.set_event_loop = set_event_loop  # type: ignore[method-assign]
     tasks._GatheringFuture.__init__ = gather  # type: ignore[attr-defined]
+    tasks._wait = wait  # type: ignore[attr-defined]
+    asyncio.as_completed = tasks.as_completed = as_completed  # type: ignore[assignment]
+    asyncio.shield = tasks.shield = shield  # type: ignore[assignment]
+    if sys.hexversion >= 0x030B0000:
+        TaskGroup.create_task = create_task  # type: ignore[method-assign]
 
 
 def unpatch():
     BaseDefaultEventLoopPolicy.set_event_loop = _set_event_loop  # type: ignore[method-assign]
     tasks._GatheringFuture.__init__ = _gather  # type: ignore[attr-defined]
+    tasks._wait = _wait  # type: ignore[attr-defined]
+    asyncio.as_completed = tasks.as_completed = _as_completed  # type: ignore[assignment]
+    asyncio.shield = tasks.shield = _shield  # type: ignore[assignment]
+    if sys.hexversion >= 0x030B0000:
+        TaskGroup.create_task = _create_task  # type: ignore[method-assign]
 
 
 def track():
@@ -6,7 +6,7 @@ import gevent.greenlet
 import gevent.hub
 from gevent import thread
 from gevent.greenlet import Greenlet as _Greenlet
-from greenlet import greenlet, settrace
+from greenlet import gettrace, greenlet, settrace
 
 import echion.core as echion
 
@@ -18,10 +18,7 @@ _gevent_wait = gevent.wait
 _gevent_iwait = gevent.iwait
 
 # Global package state
-_greenlet_frames: t.Dict[int, t.Union[FrameType, bool, None]] = {}
 _original_greenlet_tracer: t.Optional[t.Callable[[str, t.Any], None]] = None
-_greenlet_parent_map: t.Dict[int, int] = {}
-_parent_greenlet_count: t.Dict[int, int] = {}
 
 FRAME_NOT_SET = False  # Sentinel for when the frame is not set
 
@@ -52,74 +49,15 @@ def track_gevent_greenlet(greenlet: _Greenlet) -> _Greenlet:
         # This greenlet cannot be linked (e.g. the Hub)
         pass
 
-    _greenlet_frames[greenlet_id] = frame
-
     return greenlet
 
 
-def update_greenlet_frame(
-    greenlet_id: int, frame: t.Union[FrameType, bool, None]
-) -> None:
-    _greenlet_frames[greenlet_id] = frame
-    echion.update_greenlet_frame(greenlet_id, frame)
-
-
-def greenlet_tracer(event: str, args: t.Any) -> None:
-    if event in {"switch", "throw"}:
-        # This tracer function runs in the context of the target
-        origin, target = t.cast(t.Tuple[Greenlet, Greenlet], args)
-
-        if (origin_id := thread.get_ident(origin)) not in _greenlet_frames:
-            try:
-                track_gevent_greenlet(origin)
-            except GreenletTrackingError:
-                # Not something that we can track
-                pass
-
-        if (target_id := thread.get_ident(target)) not in _greenlet_frames:
-            # This is likely the hub. We take this chance to track it.
-            try:
-                track_gevent_greenlet(target)
-            except GreenletTrackingError:
-                # Not something that we can track
-                pass
-
-        try:
-            # If this is being set to None, it means the greenlet is likely
-            # finished. We use the sentinel again to signal this.
-            update_greenlet_frame(
-                origin_id,
-                t.cast(t.Optional[FrameType], origin.gr_frame) or FRAME_NOT_SET,
-            )
-            if target_id not in _parent_greenlet_count:
-                # We don't want to wipe the frame of a parent greenlet because
-                # we need to unwind it. We definitely know it is still running
-                # so if we allow the tracer to set its tracked frame to None,
-                # we won't be able to unwind the full stack.
-                update_greenlet_frame(target_id, target.gr_frame)  # this *is* None
-        except KeyError:
-            # TODO: Log missing greenlet
-            pass
-
-    if _original_greenlet_tracer is not None:
-        _original_greenlet_tracer(event, args)
-
-
 def untrack_greenlet(greenlet: _Greenlet) -> None:
-    greenlet_id = thread.get_ident(greenlet)
-    echion.untrack_greenlet(greenlet_id)
-    _greenlet_frames.pop(greenlet_id, None)
-    _parent_greenlet_count.pop(greenlet_id, None)
-    if (parent_id := _greenlet_parent_map.pop(greenlet_id, None)) is not None:
-        _parent_greenlet_count[parent_id] -= 1
-        if _parent_greenlet_count[parent_id] <= 0:
-            del _parent_greenlet_count[parent_id]
+    echion.untrack_greenlet(thread.get_ident(greenlet))
 
 
 def link_greenlets(greenlet_id: int, parent_id: int) -> None:
     echion.link_greenlets(greenlet_id, parent_id)
-    _parent_greenlet_count[parent_id] = _parent_greenlet_count.get(parent_id, 0) + 1
-    _greenlet_parent_map[greenlet_id] = parent_id
 
 
 class Greenlet(_Greenlet):
@@ -194,7 +132,12 @@ def patch() -> None:
 
     gevent.hub.spawn_raw = wrap_spawn(_gevent_hub_spawn_raw)
 
-    _original_greenlet_tracer = settrace(greenlet_tracer)
+    # The switch tracer is implemented in the core module. It keeps the frames
+    # of the greenlets up to date, and calls back to track the greenlets that
+    # it sees for the first time.
+    _original_greenlet_tracer = gettrace()
+    echion.init_greenlet_tracer(track_gevent_greenlet, _original_greenlet_tracer)
+    settrace(echion.greenlet_tracer)
 
 
 def unpatch() -> None:
@@ -209,6 +152,7 @@ def unpatch() -> None:
     gevent.hub.spawn_raw = _gevent_hub_spawn_raw
 
     settrace(_original_greenlet_tracer)
+    echion.init_greenlet_tracer(None, None)
 
 
 def track() -> None:
@@ -0,0 +1,42 @@
+import typing as t
+from functools import wraps
+from threading import current_thread
+
+import uvloop
+
+import echion.core as echion
+
+
+# -----------------------------------------------------------------------------
+
+# uvloop does not necessarily go through the event loop policy to set the
+# current loop (e.g. uvloop.run uses a loop factory), so we track the loop when
+# it starts running instead. The loop runs in C, but it looks up run_forever on
+# the instance, so wrapping it on the Python subclass is enough.
+_run_forever = uvloop.Loop.run_forever
+
+
+@wraps(_run_forever)
+def run_forever(self) -> None:
+    thread_id = t.cast(int, current_thread().ident)
+
+    echion.track_asyncio_loop(thread_id, self)
+    try:
+        return _run_forever(self)
+    finally:
+        echion.track_asyncio_loop(thread_id, None)
+
+
+# -----------------------------------------------------------------------------
+
+
+def patch():
+    uvloop.Loop.run_forever = run_forever  # type: ignore[method-assign]
+
+
+def unpatch():
+    uvloop.Loop.run_forever = _run_forever  # type: ignore[method-assign]
+
+
+def track():
+    pass
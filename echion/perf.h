@@ -0,0 +1,572 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#if defined PL_LINUX && !defined UNWIND_NATIVE_DISABLE
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <asm/perf_regs.h>
+#include <link.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+
+#include <echion/config.h>
+#include <echion/errors.h>
+
+// The native stacks are sampled by the kernel, via a software cpu-clock perf
+// event for each thread. Each sample carries the user registers and a copy of
+// the top of the user stack, which we unwind offline with libunwind, using the
+// DWARF unwind tables of the loaded modules. Since the event only fires while
+// the thread is on CPU, threads that have not produced any samples since the
+// last read get no native stack.
+
+#if defined __x86_64__
+// All the general purpose registers, which the DWARF unwind rules can refer to.
+#define PERF_REGS_MASK                                                                   \
+    (((1ULL << PERF_REG_X86_64_MAX) - 1) &                                               \
+     ~((1ULL << PERF_REG_X86_DS) | (1ULL << PERF_REG_X86_ES) | (1ULL << PERF_REG_X86_FS) | \
+       (1ULL << PERF_REG_X86_GS)))
+#define PERF_REGS_MAX PERF_REG_X86_64_MAX
+#define PERF_UNW_OBJ(fn) _Ux86_64_##fn
+#elif defined __aarch64__
+#define PERF_REGS_MASK ((1ULL << PERF_REG_ARM64_MAX) - 1)
+#define PERF_REGS_MAX PERF_REG_ARM64_MAX
+#define PERF_UNW_OBJ(fn) _Uaarch64_##fn
+#endif
+
+// PERF_NATIVE_SUPPORTED is defined by the build when the remote unwinding
+// library of libunwind is available for one of the architectures above.
+#ifndef PERF_REGS_MASK
+#undef PERF_NATIVE_SUPPORTED
+#endif
+
+#ifdef PERF_NATIVE_SUPPORTED
+
+// The copied stacks are unwound with the remote API of libunwind, which lives
+// in the libunwind-<arch> library. We cannot use the unw_* names for it, as
+// these refer to the local-only API that we use everywhere else.
+extern "C" {
+unw_addr_space_t PERF_UNW_OBJ(create_addr_space)(unw_accessors_t*, int);
+int PERF_UNW_OBJ(set_caching_policy)(unw_addr_space_t, unw_caching_policy_t);
+void PERF_UNW_OBJ(flush_cache)(unw_addr_space_t, unw_word_t, unw_word_t);
+int PERF_UNW_OBJ(init_remote)(unw_cursor_t*, unw_addr_space_t, void*);
+int PERF_UNW_OBJ(step)(unw_cursor_t*);
+int PERF_UNW_OBJ(get_reg)(unw_cursor_t*, int, unw_word_t*);
+int PERF_UNW_OBJ(dwarf_search_unwind_table)(unw_addr_space_t, unw_word_t, unw_dyn_info_t*,
+                                            unw_proc_info_t*, int, void*);
+}
+
+// The number of bytes of the user stack to copy with each sample.
+static constexpr uint32_t PERF_STACK_SIZE = 16 << 10;
+
+// The largest size of a sample record (see PerfSampler::unwind_latest).
+static constexpr size_t PERF_SAMPLE_MAX_SIZE =
+    sizeof(struct perf_event_header) + 2 * sizeof(uint32_t) + sizeof(uint64_t) +
+    __builtin_popcountll(PERF_REGS_MASK) * sizeof(uint64_t) + sizeof(uint64_t) +
+    PERF_STACK_SIZE + sizeof(uint64_t);
+
+// The number of samples that the ring buffer must be able to hold. A thread
+// produces about one sample per tick while on CPU, and we drain the ring at
+// every tick, so this leaves some room for when the sampler runs late.
+static constexpr size_t PERF_RING_SAMPLES = 4;
+
+// ----------------------------------------------------------------------------
+// A native sample, as seen by the libunwind accessors.
+struct PerfSample
+{
+    std::array<uint64_t, PERF_REGS_MAX> regs = {};
+    uint64_t sp = 0;
+    const char* stack = nullptr;
+    uint64_t stack_size = 0;
+};
+
+// ----------------------------------------------------------------------------
+// The libunwind address space for the copied stacks. Everything but the stack
+// is read from the memory of the process, which is where the unwind tables
+// and the code live.
+class PerfUnwinder
+{
+public:
+    // ------------------------------------------------------------------------
+    PerfUnwinder()
+    {
+        unw_accessors_t accessors;
+        std::memset(&accessors, 0, sizeof(accessors));
+
+        accessors.find_proc_info = find_proc_info;
+        accessors.put_unwind_info = put_unwind_info;
+        accessors.get_dyn_info_list_addr = get_dyn_info_list_addr;
+        accessors.access_mem = access_mem;
+        accessors.access_reg = access_reg;
+        accessors.access_fpreg = access_fpreg;
+        accessors.resume = resume;
+        accessors.get_proc_name = get_proc_name;
+
+        address_space = PERF_UNW_OBJ(create_addr_space)(&accessors, 0);
+        if (address_space != nullptr)
+            PERF_UNW_OBJ(set_caching_policy)(address_space, UNW_CACHE_GLOBAL);
+    }
+
+    // ------------------------------------------------------------------------
+    // Unwind the given sample and return the number of program counters
+    // written.
+    size_t unwind(PerfSample& sample, unw_word_t* pcs, size_t capacity)
+    {
+        if (address_space == nullptr || capacity == 0)
+            return 0;
+
+        unw_cursor_t cursor;
+        if (PERF_UNW_OBJ(init_remote)(&cursor, address_space, &sample) < 0)
+            return 0;
+
+        size_t count = 0;
+        do
+        {
+            unw_word_t pc;
+            if (PERF_UNW_OBJ(get_reg)(&cursor, UNW_REG_IP, &pc) < 0 || pc == 0)
+                break;
+
+            pcs[count++] = pc;
+        } while (count < capacity && PERF_UNW_OBJ(step)(&cursor) > 0);
+
+        return count;
+    }
+
+private:
+    unw_addr_space_t address_space = nullptr;
+
+    struct Segment
+    {
+        uintptr_t start;
+        uintptr_t end;
+        // The address of the .eh_frame_hdr section of the module, for the
+        // executable segments.
+        uintptr_t eh_frame_hdr;
+    };
+
+    // The segments of the loaded modules, as of the last refresh, sorted by
+    // start address.
+    inline static std::vector<Segment>& segments = *(new std::vector<Segment>());
+
+    // ------------------------------------------------------------------------
+    static void refresh_segments()
+    {
+        segments.clear();
+
+        dl_iterate_phdr(
+            [](struct dl_phdr_info* info, size_t, void*) -> int {
+                uintptr_t eh_frame_hdr = 0;
+                for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++)
+                    if (info->dlpi_phdr[i].p_type == PT_GNU_EH_FRAME)
+                        eh_frame_hdr = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+
+                for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++)
+                {
+                    auto& phdr = info->dlpi_phdr[i];
+                    if (phdr.p_type != PT_LOAD)
+                        continue;
+
+                    uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+                    segments.push_back(
+                        {start, start + phdr.p_memsz, phdr.p_flags & PF_X ? eh_frame_hdr : 0});
+                }
+
+                return 0;
+            },
+            nullptr);
+
+        std::sort(segments.begin(), segments.end(),
+                  [](const Segment& a, const Segment& b) { return a.start < b.start; });
+    }
+
+    // ------------------------------------------------------------------------
+    static Segment* find_segment(uintptr_t addr)
+    {
+        auto it = std::upper_bound(segments.begin(), segments.end(), addr,
+                                   [](uintptr_t addr, const Segment& s) { return addr < s.start; });
+        if (it == segments.begin() || addr >= (--it)->end)
+            return nullptr;
+
+        return &*it;
+    }
+
+    // ------------------------------------------------------------------------
+    static int find_proc_info(unw_addr_space_t as, unw_word_t ip, unw_proc_info_t* pi,
+                              int need_unwind_info, void* arg)
+    {
+        auto* segment = find_segment(ip);
+        if (segment == nullptr)
+        {
+            // A module might have been loaded since the last refresh.
+            refresh_segments();
+            PERF_UNW_OBJ(flush_cache)(as, 0, 0);
+            segment = find_segment(ip);
+        }
+        if (segment == nullptr || segment->eh_frame_hdr == 0)
+            return -UNW_ENOINFO;
+
+        // The .eh_frame_hdr section starts with
+        //
+        //   u8 version;
+        //   u8 eh_frame_ptr_enc;
+        //   u8 fde_count_enc;
+        //   u8 table_enc;
+        //   encoded eh_frame_ptr;
+        //   encoded fde_count;
+        //   table of (initial location, FDE address) pairs;
+        //
+        // We only support the 4-byte encodings that are used by all the common
+        // toolchains, and the binary search table that libunwind requires.
+        auto* hdr = reinterpret_cast<const uint8_t*>(segment->eh_frame_hdr);
+        if (hdr[0] != 1 || (hdr[1] & 0x0f) != DW_EH_PE_SDATA4 ||
+            hdr[2] != DW_EH_PE_UDATA4 || hdr[3] != (DW_EH_PE_DATAREL | DW_EH_PE_SDATA4))
+            return -UNW_ENOINFO;
+
+        uint32_t fde_count;
+        std::memcpy(&fde_count, hdr + 8, sizeof(fde_count));
+
+        unw_dyn_info_t di;
+        std::memset(&di, 0, sizeof(di));
+        di.format = UNW_INFO_FORMAT_REMOTE_TABLE;
+        di.start_ip = segment->start;
+        di.end_ip = segment->end;
+        di.u.rti.segbase = segment->eh_frame_hdr;
+        di.u.rti.table_data = segment->eh_frame_hdr + 12;
+        di.u.rti.table_len = fde_count * 2 * sizeof(int32_t) / sizeof(unw_word_t);
+
+        return PERF_UNW_OBJ(dwarf_search_unwind_table)(as, ip, &di, pi, need_unwind_info, arg);
+    }
+
+    // ------------------------------------------------------------------------
+    static void put_unwind_info(unw_addr_space_t, unw_proc_info_t*, void*)
+    {
+    }
+
+    // ------------------------------------------------------------------------
+    static int get_dyn_info_list_addr(unw_addr_space_t, unw_word_t*, void*)
+    {
+        return -UNW_ENOINFO;
+    }
+
+    // ------------------------------------------------------------------------
+    static int access_mem(unw_addr_space_t, unw_word_t addr, unw_word_t* valp, int write,
+                          void* arg)
+    {
+        if (write)
+            return -UNW_EINVAL;
+
+        auto* sample = static_cast<PerfSample*>(arg);
+        if (addr >= sample->sp && addr - sample->sp + sizeof(*valp) <= sample->stack_size)
+        {
+            std::memcpy(valp, sample->stack + (addr - sample->sp), sizeof(*valp));
+            return 0;
+        }
+
+        // Outside the copied stack, we only read the memory of the loaded
+        // modules, e.g. their unwind tables.
+        if (find_segment(addr) == nullptr || find_segment(addr + sizeof(*valp) - 1) == nullptr)
+            return -UNW_EINVAL;
+
+        std::memcpy(valp, reinterpret_cast<const void*>(addr), sizeof(*valp));
+        return 0;
+    }
+
+    // ------------------------------------------------------------------------
+    static int access_reg(unw_addr_space_t, unw_regnum_t regnum, unw_word_t* valp, int write,
+                          void* arg)
+    {
+        if (write)
+            return -UNW_EREADONLYREG;
+
+        auto reg = perf_reg(regnum);
+        if (reg < 0)
+            return -UNW_EBADREG;
+
+        *valp = static_cast<PerfSample*>(arg)->regs[reg];
+        return 0;
+    }
+
+    // ------------------------------------------------------------------------
+    static int access_fpreg(unw_addr_space_t, unw_regnum_t, unw_fpreg_t*, int, void*)
+    {
+        return -UNW_EINVAL;
+    }
+
+    // ------------------------------------------------------------------------
+    static int resume(unw_addr_space_t, unw_cursor_t*, void*)
+    {
+        return -UNW_EINVAL;
+    }
+
+    // ------------------------------------------------------------------------
+    static int get_proc_name(unw_addr_space_t, unw_word_t, char*, size_t, unw_word_t*, void*)
+    {
+        // Native frames are symbolized by Frame::get_native.
+        return -UNW_EINVAL;
+    }
+
+    // ------------------------------------------------------------------------
+    // Map a libunwind register number to the index of the register in the
+    // perf sample, or -1 if we don't sample it.
+    static int perf_reg(unw_regnum_t regnum)
+    {
+#if defined __x86_64__
+        switch (regnum)
+        {
+        case UNW_X86_64_RAX:
+            return PERF_REG_X86_AX;
+        case UNW_X86_64_RDX:
+            return PERF_REG_X86_DX;
+        case UNW_X86_64_RCX:
+            return PERF_REG_X86_CX;
+        case UNW_X86_64_RBX:
+            return PERF_REG_X86_BX;
+        case UNW_X86_64_RSI:
+            return PERF_REG_X86_SI;
+        case UNW_X86_64_RDI:
+            return PERF_REG_X86_DI;
+        case UNW_X86_64_RBP:
+            return PERF_REG_X86_BP;
+        case UNW_X86_64_RSP:
+            return PERF_REG_X86_SP;
+        case UNW_X86_64_RIP:
+            return PERF_REG_X86_IP;
+        default:
+            if (regnum >= UNW_X86_64_R8 && regnum <= UNW_X86_64_R15)
+                return PERF_REG_X86_R8 + (regnum - UNW_X86_64_R8);
+            return -1;
+        }
+#elif defined __aarch64__
+        // The libunwind register numbers (x0-x30, sp, pc) match the perf ones.
+        return regnum >= 0 && regnum < PERF_REG_ARM64_MAX ? regnum : -1;
+#endif
+    }
+
+    // The pointer encodings used by the .eh_frame_hdr section
+    static constexpr uint8_t DW_EH_PE_UDATA4 = 0x03;
+    static constexpr uint8_t DW_EH_PE_SDATA4 = 0x0b;
+    static constexpr uint8_t DW_EH_PE_DATAREL = 0x30;
+};
+
+// We make this a reference to a heap-allocated object so that we can avoid
+// the destruction on exit. We are in charge of cleaning up the object. Note
+// that the object will leak, but this is not a problem.
+inline PerfUnwinder& perf_unwinder = *(new PerfUnwinder());
+
+// ----------------------------------------------------------------------------
+class PerfSampler
+{
+public:
+    using Ptr = std::unique_ptr<PerfSampler>;
+
+    // ------------------------------------------------------------------------
+    [[nodiscard]] static Result<PerfSampler::Ptr> create(pid_t tid)
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_CPU_CLOCK;
+        attr.sample_period = static_cast<uint64_t>(interval) * 1000;  // ns
+        attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+        attr.sample_regs_user = PERF_REGS_MASK;
+        attr.sample_stack_user = PERF_STACK_SIZE;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        int fd = static_cast<int>(
+            syscall(SYS_perf_event_open, &attr, tid, -1 /* any CPU */, -1, PERF_FLAG_FD_CLOEXEC));
+        if (fd == -1)
+            return ErrorKind::PerfError;
+
+        // The number of data pages must be a power of 2.
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t data_pages = 1;
+        while (data_pages * page_size < PERF_RING_SAMPLES * PERF_SAMPLE_MAX_SIZE)
+            data_pages <<= 1;
+
+        size_t size = (1 + data_pages) * page_size;
+        void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ring == MAP_FAILED)
+        {
+            close(fd);
+            return ErrorKind::PerfError;
+        }
+
+        return std::make_unique<PerfSampler>(fd, ring, size, page_size);
+    }
+
+    // ------------------------------------------------------------------------
+    PerfSampler(int fd, void* ring, size_t size, size_t page_size)
+        : fd(fd), ring(ring), size(size), page_size(page_size)
+    {
+    }
+
+    // ------------------------------------------------------------------------
+    ~PerfSampler()
+    {
+        munmap(ring, size);
+        close(fd);
+    }
+
+    PerfSampler(const PerfSampler&) = delete;
+    PerfSampler& operator=(const PerfSampler&) = delete;
+
+    // ------------------------------------------------------------------------
+    // Consume all the samples collected since the last call and unwind the
+    // native stack of the most recent one. Returns the number of program
+    // counters written, which is 0 if the thread has not been on CPU.
+    size_t unwind(unw_word_t* pcs, size_t capacity)
+    {
+        if (!read_latest())
+            return 0;
+
+        return unwind_latest(pcs, std::min(static_cast<size_t>(max_frames), capacity));
+    }
+
+private:
+    int fd;
+    void* ring;
+    size_t size;
+    size_t page_size;
+
+    std::vector<char> record;
+    std::vector<char> latest;
+
+    // ------------------------------------------------------------------------
+    void copy_from_ring(const char* data, uint64_t data_size, uint64_t offset, char* dest,
+                        size_t length)
+    {
+        offset %= data_size;
+        size_t chunk = std::min(static_cast<uint64_t>(length), data_size - offset);
+        std::memcpy(dest, data + offset, chunk);
+        std::memcpy(dest + chunk, data, length - chunk);
+    }
+
+    // ------------------------------------------------------------------------
+    bool read_latest()
+    {
+        auto meta = static_cast<struct perf_event_mmap_page*>(ring);
+        auto data = static_cast<const char*>(ring) + page_size;
+        uint64_t data_size = size - page_size;
+
+        uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta->data_tail;
+
+        bool found = false;
+        while (tail < head)
+        {
+            struct perf_event_header header;
+            copy_from_ring(data, data_size, tail, reinterpret_cast<char*>(&header),
+                           sizeof(header));
+            if (header.size < sizeof(header) || header.size > head - tail)
+                break;
+
+            if (header.type == PERF_RECORD_SAMPLE)
+            {
+                record.resize(header.size);
+                copy_from_ring(data, data_size, tail, record.data(), header.size);
+                std::swap(record, latest);
+                found = true;
+            }
+            else if (header.type == PERF_RECORD_LOST)
+            {
+                // The ring was full, so the sample that we have is not the
+                // latest one and would be out of date.
+                found = false;
+            }
+
+            tail += header.size;
+        }
+
+        __atomic_store_n(&meta->data_tail, head, __ATOMIC_RELEASE);
+
+        return found;
+    }
+
+    // ------------------------------------------------------------------------
+    size_t unwind_latest(unw_word_t* pcs, size_t capacity)
+    {
+        // The layout of the sample record is
+        //
+        //   struct perf_event_header header;
+        //   u32 pid, tid;                      PERF_SAMPLE_TID
+        //   u64 abi;                           PERF_SAMPLE_REGS_USER
+        //   u64 regs[weight(mask)];            if abi != PERF_SAMPLE_REGS_ABI_NONE
+        //   u64 size;                          PERF_SAMPLE_STACK_USER
+        //   char data[size];
+        //   u64 dyn_size;                      if size != 0
+        const char* p = latest.data() + sizeof(struct perf_event_header) + 2 * sizeof(uint32_t);
+        const char* end = latest.data() + latest.size();
+
+        auto read_u64 = [&](uint64_t& value) -> bool {
+            if (p + sizeof(value) > end)
+                return false;
+            std::memcpy(&value, p, sizeof(value));
+            p += sizeof(value);
+            return true;
+        };
+
+        uint64_t abi;
+        if (!read_u64(abi) || abi == PERF_SAMPLE_REGS_ABI_NONE)
+            // The sample was taken while the thread was not running user code.
+            return 0;
+
+        PerfSample sample;
+
+        // Registers are reported in increasing order of their index.
+        for (size_t i = 0; i < PERF_REGS_MAX; i++)
+            if (PERF_REGS_MASK & (1ULL << i))
+                if (!read_u64(sample.regs[i]))
+                    return 0;
+
+        uint64_t stack_size;
+        if (!read_u64(stack_size) || stack_size == 0 ||
+            p + stack_size + sizeof(uint64_t) > end)
+            return 0;
+
+        sample.stack = p;
+        p += stack_size;
+
+        uint64_t dyn_size;
+        if (!read_u64(dyn_size))
+            return 0;
+
+#if defined __x86_64__
+        sample.sp = sample.regs[PERF_REG_X86_SP];
+#elif defined __aarch64__
+        sample.sp = sample.regs[PERF_REG_ARM64_SP];
+#endif
+        sample.stack_size = std::min(stack_size, dyn_size);
+
+        return perf_unwinder.unwind(sample, pcs, capacity);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Check whether we are allowed to open perf events, e.g. depending on the
+// value of kernel.perf_event_paranoid.
+inline bool perf_events_available()
+{
+    auto maybe_sampler = PerfSampler::create(static_cast<pid_t>(syscall(SYS_gettid)));
+
+    return static_cast<bool>(maybe_sampler);
+}
+
+#endif  // PERF_NATIVE_SUPPORTED
+
+#endif  // PL_LINUX && !UNWIND_NATIVE_DISABLE
@@ -23,9 +23,12 @@ void WhereRenderer::render_frame(Frame& frame)
 
     if (filename_str.rfind("native@", 0) == 0)
     {
+        // For native frames, the line number is the offset within the module.
+        char offset[32];
+        std::snprintf(offset, sizeof(offset), "0x%x", static_cast<unsigned int>(line));
         WhereRenderer::get().render_message(
             "\033[38;5;248;1m" + name_str + "\033[0m \033[38;5;246m(" + filename_str +
-            "\033[0m:\033[38;5;246m" + std::to_string(line) + ")\033[0m");
+            "\033[0m+\033[38;5;246m" + offset + ")\033[0m");
     }
     else
     {
@@ -53,6 +53,11 @@ public:
     virtual void render_frame(Frame& frame) = 0;
     virtual void render_cpu_time(uint64_t cpu_time) = 0;
     virtual void render_stack_end(MetricType metric_type, uint64_t delta) = 0;
+    // Marks the current stack as idle. Renderers that have no notion of idle
+    // samples can ignore it.
+    virtual void render_idle() {}
+    // Marks the current stack as sampled during a garbage collection.
+    virtual void render_gc() {}
 
     // The validity of the interface is a two-step process
     // 1. If the RendererInterface has been destroyed, obviously it's invalid
@@ -274,6 +279,22 @@ public:
         string(scope);
     }
 
+    // ------------------------------------------------------------------------
+    void inline idle()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        event(MOJO_IDLE);
+    }
+
+    // ------------------------------------------------------------------------
+    void inline gc()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        event(MOJO_GC);
+    }
+
     // ------------------------------------------------------------------------
     void inline metric_time(mojo_int_t value)
     {
@@ -323,6 +344,14 @@ public:
     {
         metric = cpu_time;
     };
+    void render_idle() override
+    {
+        idle();
+    };
+    void render_gc() override
+    {
+        gc();
+    };
     void render_stack_end(MetricType metric_type, uint64_t delta) override
     {
         if (metric_type == MetricType::Time)
@@ -458,6 +487,16 @@ public:
         getActiveRenderer()->render_cpu_time(cpu_time);
     }
 
+    void render_idle()
+    {
+        getActiveRenderer()->render_idle();
+    }
+
+    void render_gc()
+    {
+        getActiveRenderer()->render_gc();
+    }
+
     void render_stack_end(MetricType metric_type, uint64_t delta)
     {
         getActiveRenderer()->render_stack_end(metric_type, delta);
@@ -7,26 +7,294 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
-#include <mutex>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
 
 #include <echion/stacks.h>
 #include <echion/state.h>
+#include <echion/timing.h>
 
 // ----------------------------------------------------------------------------
+// In native mode, the stacks of a thread are collected by the thread itself,
+// from within a SIGPROF handler. Each thread writes them into its own
+// preallocated slot and publishes the result via the slot state. This way the
+// sampler can signal all the threads at once and collect the stacks as they
+// become available, without having to wait for each thread in turn.
+//
+// The slot state transitions are
+//
+//   IDLE -> REQUESTED   by the sampler, before signalling the thread
+//   REQUESTED -> WRITING   by the signal handler
+//   WRITING -> READY   by the signal handler, once done
+//   READY -> IDLE   by the sampler, once the stacks have been consumed
+//   REQUESTED -> IDLE   by the sampler, on timeout
+class NativeSampleSlot
+{
+public:
+    enum State : int
+    {
+        IDLE,
+        REQUESTED,
+        WRITING,
+        READY,
+    };
+
+    std::atomic<int> state = IDLE;
+
+    // The thread that owns the slot. This is only changed by the sampler while
+    // the slot is IDLE.
+    std::atomic<uintptr_t> thread_id = 0;
+
+    // The thread state of the owning thread, set by the sampler on request.
+    PyThreadState* tstate = NULL;
+
+    // The batch in which the slot was last requested. Only used by the sampler
+    // to recycle the slots of threads that are gone.
+    uint64_t batch = 0;
+
+#ifndef UNWIND_NATIVE_DISABLE
+    unw_word_t native_pcs[MAX_NATIVE_FRAMES];
+#endif  // UNWIND_NATIVE_DISABLE
+    size_t native_count = 0;
+
+    RawFrame python_frames[MAX_PYTHON_FRAMES];
+    size_t python_count = 0;
+
+    // Set by the signal handler when the stacks could not be collected.
+    bool failed = false;
+
+    // ------------------------------------------------------------------------
+    // Called from the signal handler.
+    void write()
+    {
+#if defined PL_LINUX
+        // The fallback memory reader goes through a single shared buffer, so
+        // the handlers, which run concurrently, can only read the Python stack
+        // with process_vm_readv.
+        failed = !native_leaf && safe_copy != process_vm_readv;
+        if (failed)
+            return;
+#endif  // PL_LINUX
+
+#ifndef UNWIND_NATIVE_DISABLE
+        // In leaf mode we only need the top native frames, on top of the
+        // frames of the signal handler.
+        native_count = unwind_native_stack(
+            native_pcs, native_leaf ? std::min(static_cast<size_t>(native_leaf) + 2,
+                                               MAX_NATIVE_FRAMES)
+                                    : MAX_NATIVE_FRAMES);
+#endif  // UNWIND_NATIVE_DISABLE
+        // In leaf mode the Python stack is unwound by the sampler as usual.
+        python_count =
+            native_leaf ? 0 : unwind_python_stack_raw(tstate, python_frames, MAX_PYTHON_FRAMES);
+        // NOTE: Native stacks for tasks is non-trivial, so we skip it for now.
+    }
+
+    // ------------------------------------------------------------------------
+    // Called from the sampler, once the slot is READY.
+    void resolve()
+    {
+#ifndef UNWIND_NATIVE_DISABLE
+        // The innermost two frames are usually the signal handler and the
+        // signal trampoline. We skip them.
+        resolve_native_stack(native_pcs, native_count, 2);
+#endif  // UNWIND_NATIVE_DISABLE
+        resolve_python_stack(python_frames, python_count, python_stack);
+    }
+};
+
+// ----------------------------------------------------------------------------
+class NativeSampleSlots
+{
+public:
+    // Slots are allocated lazily and never freed, so that the signal handler
+    // can always access them safely. They are recycled when their thread is
+    // gone.
+    static constexpr size_t MAX_SLOTS = 256;
+
+    // Serialises the requests made by the sampler and the where thread.
+    std::mutex lock;
+
+    // ------------------------------------------------------------------------
+    // Start a new batch of requests. Must be called with the lock held.
+    void begin_batch()
+    {
+        batch++;
+    }
+
+    // ------------------------------------------------------------------------
+    // Request the stacks of the given thread and send it the signal to collect
+    // them. Must be called with the lock held.
+    NativeSampleSlot* request(uintptr_t thread_id, PyThreadState* tstate)
+    {
+        auto slot = acquire(thread_id);
+        if (slot == nullptr)
+            return nullptr;
+
+        slot->batch = batch;
+        slot->tstate = tstate;
+        slot->state.store(NativeSampleSlot::REQUESTED, std::memory_order_release);
+
+        if (pthread_kill((pthread_t)thread_id, SIGPROF))
+        {
+            slot->state.store(NativeSampleSlot::IDLE, std::memory_order_release);
+            return nullptr;
+        }
+
+        return slot;
+    }
+
+    // ------------------------------------------------------------------------
+    // Wait for the given slots to become READY, up to the given timeout. The
+    // slots that time out, or whose handler failed, are reset to IDLE and
+    // removed from the list.
+    void wait(std::vector<NativeSampleSlot*>& requested, microsecond_t timeout)
+    {
+        auto deadline = gettime() + timeout;
+
+        for (;;)
+        {
+            bool all_ready = true;
+            for (auto slot : requested)
+            {
+                if (slot->state.load(std::memory_order_acquire) != NativeSampleSlot::READY)
+                {
+                    all_ready = false;
+                    break;
+                }
+            }
 
-inline std::mutex sigprof_handler_lock;
+            if (all_ready || gettime() >= deadline)
+                break;
+
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+
+        for (auto it = requested.begin(); it != requested.end();)
+        {
+            auto slot = *it;
+
+            int expected = NativeSampleSlot::REQUESTED;
+            if (slot->state.compare_exchange_strong(expected, NativeSampleSlot::IDLE))
+            {
+                // The signal was not handled in time.
+                it = requested.erase(it);
+                continue;
+            }
+
+            // The handler is done or is in the middle of writing the stacks,
+            // in which case it will be done shortly.
+            while (slot->state.load(std::memory_order_acquire) != NativeSampleSlot::READY)
+                std::this_thread::yield();
+
+            if (slot->failed)
+            {
+                release(slot);
+                it = requested.erase(it);
+                continue;
+            }
+
+            ++it;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    void release(NativeSampleSlot* slot)
+    {
+        slot->state.store(NativeSampleSlot::IDLE, std::memory_order_release);
+    }
+
+    // ------------------------------------------------------------------------
+    // Called from the signal handler to find the slot requested for the
+    // current thread, if any.
+    NativeSampleSlot* claim()
+    {
+        auto self = (uintptr_t)pthread_self();
+
+        for (size_t i = 0; i < MAX_SLOTS; i++)
+        {
+            auto slot = slots[i].load(std::memory_order_acquire);
+            if (slot == nullptr)
+                break;
+
+            if (slot->thread_id.load(std::memory_order_relaxed) != self)
+                continue;
+
+            int expected = NativeSampleSlot::REQUESTED;
+            if (slot->state.compare_exchange_strong(expected, NativeSampleSlot::WRITING))
+                return slot;
+        }
+
+        return nullptr;
+    }
+
+private:
+    std::atomic<NativeSampleSlot*> slots[MAX_SLOTS] = {};
+    uint64_t batch = 0;
+
+    // ------------------------------------------------------------------------
+    NativeSampleSlot* acquire(uintptr_t thread_id)
+    {
+        NativeSampleSlot* stale = nullptr;
+
+        size_t i = 0;
+        for (; i < MAX_SLOTS; i++)
+        {
+            auto slot = slots[i].load(std::memory_order_acquire);
+            if (slot == nullptr)
+                break;
+
+            if (slot->thread_id.load(std::memory_order_relaxed) == thread_id)
+                return slot->state.load() == NativeSampleSlot::IDLE ? slot : nullptr;
+
+            // A slot that was not requested in the previous batch belongs to
+            // a thread that is likely gone.
+            if (stale == nullptr && slot->batch + 1 < batch &&
+                slot->state.load() == NativeSampleSlot::IDLE)
+                stale = slot;
+        }
+
+        if (i < MAX_SLOTS)
+        {
+            auto slot = new NativeSampleSlot();
+            slot->thread_id.store(thread_id, std::memory_order_relaxed);
+            slots[i].store(slot, std::memory_order_release);
+            return slot;
+        }
+
+        if (stale != nullptr)
+            stale->thread_id.store(thread_id, std::memory_order_relaxed);
+
+        return stale;
+    }
+};
+
+// We make this a reference to a heap-allocated object so that we can avoid
+// the destruction on exit. We are in charge of cleaning up the object. Note
+// that the object will leak, but this is not a problem.
+inline auto& native_sample_slots = *(new NativeSampleSlots());
 
 // ----------------------------------------------------------------------------
 inline void sigprof_handler([[maybe_unused]] int signum)
 {
-#ifndef UNWIND_NATIVE_DISABLE
-    unwind_native_stack();
-#endif  // UNWIND_NATIVE_DISABLE
-    unwind_python_stack(current_tstate);
-    // NOTE: Native stacks for tasks is non-trivial, so we skip it for now.
+    auto saved_errno = errno;
 
-    sigprof_handler_lock.unlock();
+    auto slot = native_sample_slots.claim();
+    if (slot != nullptr)
+    {
+        slot->write();
+        slot->state.store(NativeSampleSlot::READY, std::memory_order_release);
+    }
+
+    errno = saved_errno;
 }
 
 // ----------------------------------------------------------------------------
@@ -37,11 +305,38 @@ inline void sigquit_handler([[maybe_unused]] int signum)
     where_cv.notify_one();
 }
 
+// ----------------------------------------------------------------------------
+// SIGUSR2 is free for applications to use, so we pass it on to whatever handler
+// was installed before us, and put that back when we stop.
+inline struct sigaction previous_sigusr2_action;
+
+// ----------------------------------------------------------------------------
+inline void sigusr2_handler(int signum, siginfo_t* info, void* context)
+{
+    // The heap is dumped by the sampler thread at the next tick
+    heap_dump_requested.store(true);
+
+    auto& previous = previous_sigusr2_action;
+    if (previous.sa_flags & SA_SIGINFO)
+        previous.sa_sigaction(signum, info, context);
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+        previous.sa_handler(signum);
+}
+
 // ----------------------------------------------------------------------------
 inline void install_signals()
 {
     signal(SIGQUIT, sigquit_handler);
 
+    if (memory)
+    {
+        struct sigaction action = {};
+        action.sa_sigaction = sigusr2_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigaction(SIGUSR2, &action, &previous_sigusr2_action);
+    }
+
     if (native)
         signal(SIGPROF, sigprof_handler);
 }
@@ -51,6 +346,9 @@ inline void restore_signals()
 {
     signal(SIGQUIT, SIG_DFL);
 
+    if (memory)
+        sigaction(SIGUSR2, &previous_sigusr2_action, NULL);
+
     if (native)
         signal(SIGPROF, SIG_DFL);
 }
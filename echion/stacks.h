@@ -7,10 +7,13 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <deque>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #ifndef UNWIND_NATIVE_DISABLE
 #define UNW_LOCAL_ONLY
@@ -19,6 +22,7 @@
 
 #include <echion/config.h>
 #include <echion/frame.h>
+#include <echion/hash.h>
 #include <echion/mojo.h>
 #if PY_VERSION_HEX >= 0x030b0000
 #include "echion/stack_chunk.h"
@@ -33,17 +37,6 @@ public:
     using Ptr = std::unique_ptr<FrameStack>;
     using Key = Frame::Key;
 
-    // ------------------------------------------------------------------------
-    Key key()
-    {
-        Key h = 0;
-
-        for (auto it = this->begin(); it != this->end(); ++it)
-            h = rotl(h) ^ (*it).get().cache_key;
-
-        return h;
-    }
-
     // ------------------------------------------------------------------------
     void render()
     {
@@ -71,24 +64,25 @@ public:
             WhereRenderer::get().render_frame((*it).get());
         }
     }
-
-private:
-    // ------------------------------------------------------------------------
-    static inline Frame::Key rotl(Key key)
-    {
-        return (key << 1) | (key >> (CHAR_BIT * sizeof(key) - 1));
-    }
 };
 
 // ----------------------------------------------------------------------------
 
 inline FrameStack python_stack;
+// The addresses of the frames of python_stack, in the same order
+inline std::vector<PyObject*> python_stack_addrs;
 inline FrameStack native_stack;
 inline FrameStack interleaved_stack;
 
 // ----------------------------------------------------------------------------
 #ifndef UNWIND_NATIVE_DISABLE
-inline void unwind_native_stack()
+// The signal handler only records the raw program counters of the native
+// stack. Symbolization is deferred to the sampler thread, where it is safe to
+// allocate, take locks and read symbol tables.
+static constexpr size_t MAX_NATIVE_FRAMES = 2048;
+
+// ----------------------------------------------------------------------------
+inline size_t unwind_native_stack(unw_word_t* pcs, size_t capacity)
 {
     unw_cursor_t cursor;
     unw_context_t context;
@@ -96,22 +90,36 @@ inline void unwind_native_stack()
     unw_getcontext(&context);
     unw_init_local(&cursor, &context);
 
-    native_stack.clear();
+    size_t limit = std::min(static_cast<size_t>(max_frames), capacity);
+    size_t count = 0;
 
-    while (unw_step(&cursor) > 0 && native_stack.size() < max_frames)
+    while (unw_step(&cursor) > 0 && count < limit)
     {
-        auto maybe_frame = Frame::get(cursor);
-        if (!maybe_frame) {
+        unw_word_t pc;
+        if (unw_get_reg(&cursor, UNW_REG_IP, &pc) || pc == 0)
             break;
-        }
 
-        native_stack.push_back(*maybe_frame);
+        pcs[count++] = pc;
     }
+
+    return count;
+}
+
+// ----------------------------------------------------------------------------
+// Resolve the given program counters, skipping the first (innermost) ones as
+// requested, e.g. to drop the frames of the signal handler.
+inline void resolve_native_stack(const unw_word_t* pcs, size_t count, size_t skip = 0)
+{
+    native_stack.clear();
+
+    for (size_t i = skip; i < count; i++)
+        native_stack.push_back(Frame::get_native(pcs[i]));
 }
 #endif  // UNWIND_NATIVE_DISABLE
 
 // ----------------------------------------------------------------------------
-static size_t unwind_frame(PyObject* frame_addr, FrameStack& stack)
+static size_t unwind_frame(PyObject* frame_addr, FrameStack& stack,
+                           std::vector<PyObject*>* frame_addrs = nullptr)
 {
     std::unordered_set<PyObject*> seen_frames;  // Used to detect cycles in the stack
     int count = 0;
@@ -123,6 +131,7 @@ static size_t unwind_frame(PyObject* frame_addr, FrameStack& stack)
             break;
 
         seen_frames.insert(current_frame_addr);
+        PyObject* read_addr = current_frame_addr;
 
 #if PY_VERSION_HEX >= 0x030b0000
         auto maybe_frame =
@@ -136,6 +145,8 @@ static size_t unwind_frame(PyObject* frame_addr, FrameStack& stack)
         }
 
         stack.push_back(*maybe_frame);
+        if (frame_addrs != nullptr)
+            frame_addrs->push_back(read_addr);
         count++;
     }
 
@@ -187,9 +198,12 @@ static size_t unwind_frame_unsafe(PyObject* frame, FrameStack& stack)
 }
 
 // ----------------------------------------------------------------------------
-static void unwind_python_stack(PyThreadState* tstate, FrameStack& stack)
+static void unwind_python_stack(PyThreadState* tstate, FrameStack& stack,
+                                std::vector<PyObject*>* frame_addrs = nullptr)
 {
     stack.clear();
+    if (frame_addrs != nullptr)
+        frame_addrs->clear();
 #if PY_VERSION_HEX >= 0x030b0000
     if (stack_chunk == nullptr)
     {
@@ -214,7 +228,7 @@ static void unwind_python_stack(PyThreadState* tstate, FrameStack& stack)
 #else  // Python < 3.11
     PyObject* frame_addr = (PyObject*)tstate->frame;
 #endif
-    unwind_frame(frame_addr, stack);
+    unwind_frame(frame_addr, stack, frame_addrs);
 }
 
 // ----------------------------------------------------------------------------
@@ -242,10 +256,152 @@ static void unwind_python_stack_unsafe(PyThreadState* tstate, FrameStack& stack)
     unwind_frame_unsafe(frame_addr, stack);
 }
 
+// ----------------------------------------------------------------------------
+// A Python frame as captured from within a signal handler, before any of the
+// code object details have been resolved.
+struct RawFrame
+{
+    PyCodeObject* code;
+    int lasti;
+#if PY_VERSION_HEX >= 0x030b0000
+    bool is_entry;
+#endif
+};
+
+static constexpr size_t MAX_PYTHON_FRAMES = 2048;
+
+// ----------------------------------------------------------------------------
+// Record the code object and the last instruction of each frame of the given
+// thread. This is meant to be called from within a signal handler, so we don't
+// allocate, nor we take any locks. We only read memory via copies that fail
+// gracefully on invalid addresses.
+static size_t unwind_python_stack_raw(PyThreadState* tstate_addr, RawFrame* frames,
+                                      size_t capacity)
+{
+    size_t limit = std::min(static_cast<size_t>(max_frames), capacity);
+    size_t count = 0;
+
+#if PY_VERSION_HEX >= 0x030d0000
+    _PyInterpreterFrame* frame_addr;
+    if (copy_type(&tstate_addr->current_frame, frame_addr))
+        return 0;
+#elif PY_VERSION_HEX >= 0x030b0000
+    _PyCFrame* cframe_addr;
+    _PyCFrame cframe;
+    if (copy_type(&tstate_addr->cframe, cframe_addr) || copy_type(cframe_addr, cframe))
+        return 0;
+
+    _PyInterpreterFrame* frame_addr = cframe.current_frame;
+#else
+    PyFrameObject* frame_addr;
+    if (copy_type(&tstate_addr->frame, frame_addr))
+        return 0;
+#endif
+
+    while (frame_addr != NULL && count < limit)
+    {
+#if PY_VERSION_HEX >= 0x030b0000
+        _PyInterpreterFrame iframe;
+        if (copy_type(frame_addr, iframe))
+            break;
+
+#if PY_VERSION_HEX >= 0x030d0000
+        // Skip the frames that are not backed by a code object (see
+        // Frame::read).
+        PyObject executable;
+        if (copy_type(iframe.f_executable, executable))
+            break;
+
+        if (executable.ob_type == &PyCode_Type)
+        {
+            auto code = reinterpret_cast<PyCodeObject*>(iframe.f_executable);
+            frames[count++] = {
+                code,
+                static_cast<int>(iframe.instr_ptr - 1 - reinterpret_cast<_Py_CODEUNIT*>(code)) -
+                    static_cast<int>(offsetof(PyCodeObject, co_code_adaptive) /
+                                     sizeof(_Py_CODEUNIT)),
+                iframe.owner == FRAME_OWNED_BY_CSTACK,
+            };
+        }
+#else
+        frames[count++] = {
+            iframe.f_code,
+            static_cast<int>(iframe.prev_instr - reinterpret_cast<_Py_CODEUNIT*>(iframe.f_code)) -
+                static_cast<int>(offsetof(PyCodeObject, co_code_adaptive) /
+                                 sizeof(_Py_CODEUNIT)),
+#if PY_VERSION_HEX >= 0x030c0000
+            iframe.owner == FRAME_OWNED_BY_CSTACK,
+#else
+            static_cast<bool>(iframe.is_entry),
+#endif
+        };
+#endif  // PY_VERSION_HEX >= 0x030d0000
+
+        frame_addr = iframe.previous;
+#else
+        PyFrameObject py_frame;
+        if (copy_type(frame_addr, py_frame))
+            break;
+
+        frames[count++] = {py_frame.f_code, py_frame.f_lasti};
+
+        frame_addr = py_frame.f_back;
+#endif  // PY_VERSION_HEX >= 0x030b0000
+    }
+
+    return count;
+}
+
+// ----------------------------------------------------------------------------
+static void resolve_python_stack(const RawFrame* frames, size_t count, FrameStack& stack)
+{
+    stack.clear();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto maybe_frame = Frame::get(frames[i].code, frames[i].lasti);
+        if (!maybe_frame)
+            break;
+
+        auto& frame = maybe_frame->get();
+#if PY_VERSION_HEX >= 0x030b0000
+        if (&frame != &INVALID_FRAME)
+            frame.is_entry = frames[i].is_entry;
+#endif
+
+        stack.push_back(frame);
+    }
+}
+
 // ----------------------------------------------------------------------------
 static void unwind_python_stack(PyThreadState* tstate)
 {
-    unwind_python_stack(tstate, python_stack);
+    unwind_python_stack(tstate, python_stack, &python_stack_addrs);
+}
+
+// ----------------------------------------------------------------------------
+// Check that the native stack has one evaluation loop frame for each run of
+// Python frames that interleave_stacks would put in its place.
+static bool eval_frames_match(const FrameStack& python_stack)
+{
+    size_t eval_frames = 0;
+    for (auto& frame : native_stack)
+    {
+        auto maybe_name = string_table.lookup(frame.get().name);
+        if (maybe_name && (*maybe_name)->find("PyEval_EvalFrameDefault") != std::string::npos)
+            eval_frames++;
+    }
+
+#if PY_VERSION_HEX >= 0x030b0000
+    // Each run starts with an entry frame.
+    auto runs = static_cast<size_t>(
+        std::count_if(python_stack.begin(), python_stack.end(),
+                      [](const Frame::Ref& frame) { return frame.get().is_entry; }));
+#else
+    auto runs = python_stack.size();
+#endif
+
+    return eval_frames == runs;
 }
 
 // ----------------------------------------------------------------------------
@@ -253,10 +409,32 @@ static Result<void> interleave_stacks(FrameStack& python_stack)
 {
     interleaved_stack.clear();
 
+    if (native_leaf)
+    {
+        // In leaf mode, the top native frames are attached on top of the
+        // Python stack.
+        interleaved_stack = python_stack;
+        for (auto n = native_stack.rbegin(); n != native_stack.rend(); ++n)
+            interleaved_stack.push_front(*n);
+
+        return Result<void>::ok();
+    }
+
+    if (native_stack.empty())
+    {
+        // We have no native stack to interleave with, e.g. because the thread
+        // has not been on CPU since the last sample.
+        interleaved_stack = python_stack;
+        return Result<void>::ok();
+    }
+
+    if (native_perf && !eval_frames_match(python_stack))
+        // The native stack was sampled by the kernel at some point before we
+        // read the Python stack, and the thread has moved on since.
+        return ErrorKind::PerfError;
+
     auto p = python_stack.rbegin();
-    // The last two frames are usually the signal trampoline and the signal
-    // handler. We skip them.
-    for (auto n = native_stack.rbegin(); n != native_stack.rend() - 2; ++n)
+    for (auto n = native_stack.rbegin(); n != native_stack.rend(); ++n)
     {
         auto native_frame = *n;
 
@@ -317,6 +495,83 @@ static Result<void> interleave_stacks()
     return interleave_stacks(python_stack);
 }
 
+// ----------------------------------------------------------------------------
+// A contiguous range of frames within a FrameBuffer, from leaf to root.
+struct FrameSpan
+{
+    size_t start = 0;
+    size_t length = 0;
+};
+
+// ----------------------------------------------------------------------------
+// A buffer of frames shared by many stacks. Stacks are described as sequences
+// of spans over the buffer, so that common parts, like the frames of a parent
+// task or of the thread, are stored only once.
+class FrameBuffer : public std::vector<Frame::Ref>
+{
+public:
+    // ------------------------------------------------------------------------
+    FrameSpan append(const FrameStack& stack, size_t from = 0)
+    {
+        return append(stack, from, stack.size() - std::min(from, stack.size()));
+    }
+
+    // ------------------------------------------------------------------------
+    FrameSpan append(const FrameStack& stack, size_t from, size_t count)
+    {
+        FrameSpan span = {this->size(), 0};
+
+        for (size_t i = from; i < from + count && i < stack.size(); i++)
+            this->push_back(stack[i]);
+
+        span.length = this->size() - span.start;
+
+        return span;
+    }
+
+    // ------------------------------------------------------------------------
+    // Append a single frame to the last span.
+    void extend(FrameSpan& span, Frame& frame)
+    {
+        this->push_back(frame);
+        span.length++;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// A stack made of spans over a FrameBuffer, from leaf to root.
+class SpanStack : public std::vector<FrameSpan>
+{
+public:
+    // ------------------------------------------------------------------------
+    void render(FrameBuffer& buffer)
+    {
+        for (auto span = this->rbegin(); span != this->rend(); ++span)
+        {
+            for (size_t i = span->start + span->length; i-- > span->start;)
+            {
+                auto& frame = buffer[i].get();
+#if PY_VERSION_HEX >= 0x030c0000
+                if (frame.is_entry)
+                    // This is a shim frame so we skip it.
+                    continue;
+#endif
+                Renderer::get().render_frame(frame);
+            }
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    void materialize(FrameBuffer& buffer, FrameStack& stack)
+    {
+        stack.clear();
+
+        for (auto& span : *this)
+            for (size_t i = span.start; i < span.start + span.length; i++)
+                stack.push_back(buffer[i]);
+    }
+};
+
 // ----------------------------------------------------------------------------
 class StackInfo
 {
@@ -325,41 +580,101 @@ public:
     bool on_cpu;
     FrameStack stack;
 
+    // Task stacks are described by spans over a shared frame buffer instead.
+    SpanStack spans;
+
+    // The factor by which the metric of the stack is scaled, e.g. when only a
+    // sample of the tasks is unwound.
+    double weight = 1.0;
+
     StackInfo(StringTable::Key task_name, bool on_cpu) : task_name(task_name), on_cpu(on_cpu) {}
 };
 
 // ----------------------------------------------------------------------------
-// This table is used to store entire stacks and index them by key. This is
-// used when profiling memory events to account for deallocations.
+// A trie of the stored frame stacks. Each node is a frame together with the
+// node of its caller, so that a stack is identified by the node of its leaf
+// frame and the common prefixes are stored only once. The memory usage thus
+// grows with the number of unique frames at each call site, rather than with
+// the number of unique stacks times their depth.
 class StackTable
 {
 public:
+    using Key = uint32_t;
+
+    // The key of the empty stack
+    static constexpr Key ROOT = 0;
+
+    // A frame in the trie. Besides the frame key, we keep the details that
+    // are needed to report the stack, as the frame might have been evicted
+    // from the frame cache by the time we do.
+    struct Node
+    {
+        Key parent;
+        Frame::Key frame;
+        StringTable::Key filename;
+        StringTable::Key name;
+        int line;
+    };
+
+    // ------------------------------------------------------------------------
+    StackTable()
+    {
+        nodes.push_back({ROOT, 0, 0, 0, 0});
+    }
+
     // ------------------------------------------------------------------------
-    FrameStack::Key inline store(FrameStack::Ptr stack)
+    Key inline store(const FrameStack& stack)
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
-        auto stack_key = stack->key();
+        Key node = ROOT;
 
-        auto stack_entry = table.find(stack_key);
-        if (stack_entry == table.end())
+        // The stack has the leaf frame at the front, so we walk it backwards.
+        for (auto it = stack.rbegin(); it != stack.rend(); ++it)
         {
-            table.emplace(stack_key, std::move(stack));
+#if PY_VERSION_HEX >= 0x030c0000
+            if ((*it).get().is_entry)
+                // This is a shim frame so we skip it.
+                continue;
+#endif
+            auto& frame = (*it).get();
+
+            auto [child, inserted] =
+                children.try_emplace({node, frame.cache_key}, static_cast<Key>(nodes.size()));
+            if (inserted)
+                nodes.push_back(
+                    {node, frame.cache_key, frame.filename, frame.name, frame.location.line});
+
+            node = child->second;
         }
-        else
+
+        return node;
+    }
+
+    // ------------------------------------------------------------------------
+    // Retrieve the frames of the stack with the given key, from the outermost
+    // to the leaf.
+    std::vector<Node> retrieve(Key key)
+    {
+        std::vector<Node> frames;
+
         {
-            // TODO: Check for collisions.
+            std::lock_guard<std::mutex> lock(this->lock);
+
+            for (; key != ROOT && key < nodes.size(); key = nodes[key].parent)
+                frames.push_back(nodes[key]);
         }
 
-        return stack_key;
+        std::reverse(frames.begin(), frames.end());
+
+        return frames;
     }
 
     // ------------------------------------------------------------------------
-    FrameStack& retrieve(FrameStack::Key stack_key)
+    void render(Key key)
     {
-        std::lock_guard<std::mutex> lock(this->lock);
-
-        return *table.find(stack_key)->second;
+        for (auto& node : retrieve(key))
+            Renderer::get().frame_ref(node.frame);
     }
 
     // ------------------------------------------------------------------------
@@ -367,11 +682,32 @@ public:
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
-        table.clear();
+        children.clear();
+        nodes.resize(1);
     }
 
 private:
-    std::unordered_map<FrameStack::Key, std::unique_ptr<FrameStack>> table;
+    struct Edge
+    {
+        Key parent;
+        Frame::Key frame;
+
+        bool operator==(const Edge& other) const
+        {
+            return parent == other.parent && frame == other.frame;
+        }
+    };
+
+    struct EdgeHash
+    {
+        size_t operator()(const Edge& edge) const
+        {
+            return static_cast<size_t>(hash_pair(edge.frame, edge.parent));
+        }
+    };
+
+    std::vector<Node> nodes;
+    std::unordered_map<Edge, Key, EdgeHash> children;
     std::mutex lock;
 };
 
@@ -12,12 +12,12 @@
 #define Py_BUILD_CORE
 #include <internal/pycore_pystate.h>
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 
 inline _PyRuntimeState* runtime = &_PyRuntime;
-inline PyThreadState* current_tstate = NULL;
 
 inline std::thread* sampler_thread = nullptr;
 
@@ -27,6 +27,12 @@ inline std::thread* where_thread = nullptr;
 inline std::condition_variable where_cv;
 inline std::mutex where_lock;
 
+// Set by the SIGUSR2 handler to request a heap dump in memory mode
+inline std::atomic<bool> heap_dump_requested = false;
+
+// Whether the memory hooks are installed, i.e. memory mode is fully set up
+inline std::atomic<bool> memory_ready = false;
+
 inline PyObject* asyncio_current_tasks = NULL;
 inline PyObject* asyncio_scheduled_tasks = NULL;  // WeakSet
 inline PyObject* asyncio_eager_tasks = NULL;      // set
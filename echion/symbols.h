@@ -0,0 +1,409 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cxxabi.h>
+
+#if defined PL_LINUX
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined PL_DARWIN
+#include <dlfcn.h>
+#endif
+
+#include <echion/errors.h>
+#include <echion/strings.h>
+
+// Native frames are recorded as raw program counters by the signal handler.
+// The resolution to (module, offset) pairs and symbol names happens here,
+// outside of the signal handler, from the sampler thread.
+
+// ----------------------------------------------------------------------------
+struct NativeSymbol
+{
+    StringTable::Key module = 0;
+    uintptr_t offset = 0;
+    StringTable::Key name = StringTable::UNKNOWN;
+};
+
+// ----------------------------------------------------------------------------
+static std::string demangle(const char* name)
+{
+    // Try to demangle C++ names
+    if (name[0] == '_' && name[1] == 'Z')
+    {
+        int status;
+        char* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+        if (status == 0 && demangled != NULL)
+        {
+            std::string result(demangled);
+            std::free(demangled);
+            return result;
+        }
+    }
+
+    return std::string(name);
+}
+
+#if defined PL_LINUX
+// ----------------------------------------------------------------------------
+class ElfSymbolIndex
+{
+public:
+    using Ptr = std::unique_ptr<ElfSymbolIndex>;
+
+    struct Symbol
+    {
+        uintptr_t address;
+        size_t size;
+        std::string name;
+    };
+
+    [[nodiscard]] static Result<ElfSymbolIndex::Ptr> create(const std::string& path);
+
+    // Resolve an offset within the ELF file to the function symbol that
+    // contains it. The returned address is the virtual address of the
+    // offset, as seen by the symbol tables.
+    [[nodiscard]] Result<const Symbol*> lookup(uintptr_t file_offset, uintptr_t* address) const;
+
+private:
+    struct Segment
+    {
+        uintptr_t offset;
+        size_t size;
+        uintptr_t address;
+    };
+
+    std::vector<Segment> segments;
+    std::vector<Symbol> symbols;  // Sorted by address
+};
+
+// ----------------------------------------------------------------------------
+inline Result<ElfSymbolIndex::Ptr> ElfSymbolIndex::create(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return ErrorKind::SymbolError;
+
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(ElfW(Ehdr)))
+    {
+        close(fd);
+        return ErrorKind::SymbolError;
+    }
+
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return ErrorKind::SymbolError;
+
+    // Make sure that the mapping is released on every return path.
+    std::unique_ptr<void, std::function<void(void*)>> guard(
+        map, [size](void* p) { munmap(p, size); });
+
+    auto image = static_cast<const char*>(map);
+    auto ehdr = reinterpret_cast<const ElfW(Ehdr)*>(image);
+
+    // We only symbolize modules loaded in our own process, so we expect the
+    // native ELF class.
+    if (std::memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+        ehdr->e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32))
+        return ErrorKind::SymbolError;
+
+    auto in_bounds = [size](size_t offset, size_t length) {
+        return offset <= size && length <= size - offset;
+    };
+
+    if (!in_bounds(ehdr->e_phoff, ehdr->e_phnum * sizeof(ElfW(Phdr))) ||
+        !in_bounds(ehdr->e_shoff, ehdr->e_shnum * sizeof(ElfW(Shdr))))
+        return ErrorKind::SymbolError;
+
+    auto index = std::make_unique<ElfSymbolIndex>();
+
+    // Collect the loadable segments to map file offsets to virtual addresses.
+    auto phdrs = reinterpret_cast<const ElfW(Phdr)*>(image + ehdr->e_phoff);
+    for (int i = 0; i < ehdr->e_phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_LOAD)
+            index->segments.push_back({phdrs[i].p_offset, phdrs[i].p_filesz, phdrs[i].p_vaddr});
+    }
+
+    // Collect the function symbols from both .symtab and .dynsym. The former
+    // is usually stripped, but when it is present it also covers the local
+    // symbols that the dynamic linker knows nothing about.
+    auto shdrs = reinterpret_cast<const ElfW(Shdr)*>(image + ehdr->e_shoff);
+    for (int i = 0; i < ehdr->e_shnum; i++)
+    {
+        auto& shdr = shdrs[i];
+        if ((shdr.sh_type != SHT_SYMTAB && shdr.sh_type != SHT_DYNSYM) ||
+            shdr.sh_entsize != sizeof(ElfW(Sym)) || shdr.sh_link >= ehdr->e_shnum)
+            continue;
+
+        auto& strtab = shdrs[shdr.sh_link];
+        if (!in_bounds(shdr.sh_offset, shdr.sh_size) ||
+            !in_bounds(strtab.sh_offset, strtab.sh_size))
+            continue;
+
+        auto syms = reinterpret_cast<const ElfW(Sym)*>(image + shdr.sh_offset);
+        auto strs = image + strtab.sh_offset;
+        for (size_t j = 0; j < shdr.sh_size / sizeof(ElfW(Sym)); j++)
+        {
+            auto& sym = syms[j];
+            auto type = ELF64_ST_TYPE(sym.st_info);
+            if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym.st_shndx == SHN_UNDEF ||
+                sym.st_value == 0 || sym.st_name >= strtab.sh_size)
+                continue;
+
+            auto name = strs + sym.st_name;
+            auto length = strnlen(name, strtab.sh_size - sym.st_name);
+            if (length == 0 || length == strtab.sh_size - sym.st_name)
+                continue;
+
+            index->symbols.push_back({sym.st_value, sym.st_size, std::string(name, length)});
+        }
+    }
+
+    // Symbols that appear in both tables are kept once, preferring the one
+    // with the larger size information.
+    std::sort(index->symbols.begin(), index->symbols.end(),
+              [](const Symbol& a, const Symbol& b) {
+                  return a.address < b.address || (a.address == b.address && a.size > b.size);
+              });
+    index->symbols.erase(std::unique(index->symbols.begin(), index->symbols.end(),
+                                     [](const Symbol& a, const Symbol& b) {
+                                         return a.address == b.address;
+                                     }),
+                         index->symbols.end());
+    index->symbols.shrink_to_fit();
+
+    return index;
+}
+
+// ----------------------------------------------------------------------------
+inline Result<const ElfSymbolIndex::Symbol*> ElfSymbolIndex::lookup(uintptr_t file_offset,
+                                                                    uintptr_t* address) const
+{
+    auto segment = std::find_if(segments.cbegin(), segments.cend(), [=](const Segment& s) {
+        return file_offset >= s.offset && file_offset < s.offset + s.size;
+    });
+    if (segment == segments.cend())
+        return ErrorKind::SymbolError;
+
+    *address = file_offset - segment->offset + segment->address;
+
+    auto it = std::upper_bound(
+        symbols.cbegin(), symbols.cend(), *address,
+        [](uintptr_t address, const Symbol& symbol) { return address < symbol.address; });
+    if (it == symbols.cbegin())
+        return ErrorKind::SymbolError;
+
+    auto& symbol = *--it;
+    // Symbols with no size information are accepted as the closest match.
+    if (symbol.size != 0 && *address >= symbol.address + symbol.size)
+        return ErrorKind::SymbolError;
+
+    return &symbol;
+}
+
+// ----------------------------------------------------------------------------
+class MemoryMaps
+{
+public:
+    struct Mapping
+    {
+        uintptr_t start;
+        uintptr_t end;
+        uintptr_t offset;
+        std::string path;
+    };
+
+    // ------------------------------------------------------------------------
+    void refresh()
+    {
+        mappings.clear();
+
+        FILE* maps = std::fopen("/proc/self/maps", "r");
+        if (maps == NULL)
+            return;
+
+        char line[4096];
+        while (std::fgets(line, sizeof(line), maps) != NULL)
+        {
+            unsigned long start, end, offset;
+            char perms[5] = {0};
+            int path_start = 0;
+
+            if (std::sscanf(line, "%lx-%lx %4s %lx %*s %*s %n", &start, &end, perms, &offset,
+                            &path_start) < 4)
+                continue;
+
+            // We are only interested in file-backed executable mappings
+            if (perms[2] != 'x' || path_start == 0 || line[path_start] != '/')
+                continue;
+
+            std::string path(line + path_start);
+            if (!path.empty() && path.back() == '\n')
+                path.pop_back();
+
+            mappings.push_back({start, end, offset, std::move(path)});
+        }
+
+        std::fclose(maps);
+
+        std::sort(mappings.begin(), mappings.end(),
+                  [](const Mapping& a, const Mapping& b) { return a.start < b.start; });
+    }
+
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<const Mapping*> find(uintptr_t address) const
+    {
+        auto it = std::upper_bound(
+            mappings.cbegin(), mappings.cend(), address,
+            [](uintptr_t address, const Mapping& m) { return address < m.start; });
+        if (it == mappings.cbegin())
+            return ErrorKind::SymbolError;
+
+        auto& mapping = *--it;
+        if (address >= mapping.end)
+            return ErrorKind::SymbolError;
+
+        return &mapping;
+    }
+
+private:
+    std::vector<Mapping> mappings;
+};
+#endif  // PL_LINUX
+
+// ----------------------------------------------------------------------------
+class Symbolizer
+{
+public:
+    [[nodiscard]] inline Result<NativeSymbol> resolve(uintptr_t pc);
+
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+#if defined PL_LINUX
+        maps = MemoryMaps();
+        maps_loaded = false;
+        indices.clear();
+#endif
+    }
+
+private:
+    std::mutex lock;
+
+#if defined PL_LINUX
+    MemoryMaps maps;
+    bool maps_loaded = false;
+
+    // ELF symbol indices are built lazily, the first time that a module is
+    // needed. A null entry marks a module that we failed to index.
+    std::unordered_map<std::string, ElfSymbolIndex::Ptr> indices;
+
+    // ------------------------------------------------------------------------
+    const ElfSymbolIndex* index(const std::string& path)
+    {
+        auto it = indices.find(path);
+        if (it == indices.end())
+        {
+            auto maybe_index = ElfSymbolIndex::create(path);
+            it = indices.emplace(path, maybe_index ? std::move(*maybe_index) : nullptr).first;
+        }
+
+        return it->second.get();
+    }
+#endif
+};
+
+// ----------------------------------------------------------------------------
+inline Result<NativeSymbol> Symbolizer::resolve(uintptr_t pc)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    NativeSymbol symbol;
+
+#if defined PL_LINUX
+    if (!maps_loaded)
+    {
+        maps.refresh();
+        maps_loaded = true;
+    }
+
+    auto maybe_mapping = maps.find(pc);
+    if (!maybe_mapping)
+    {
+        // The address might belong to a module that has been loaded since we
+        // last read the memory maps.
+        maps.refresh();
+        maybe_mapping = maps.find(pc);
+        if (!maybe_mapping)
+            return ErrorKind::SymbolError;
+    }
+
+    auto mapping = *maybe_mapping;
+
+    // We use the nominal load address of the module as the key of its name.
+    symbol.module = string_table.key(mapping->start - mapping->offset, "native@" + mapping->path);
+    symbol.offset = pc - mapping->start + mapping->offset;
+
+    auto elf_index = index(mapping->path);
+    if (elf_index == nullptr)
+        return symbol;
+
+    uintptr_t address = 0;
+    auto maybe_elf_symbol = elf_index->lookup(symbol.offset, &address);
+    if (!maybe_elf_symbol)
+        return symbol;
+
+    auto elf_symbol = *maybe_elf_symbol;
+
+    // The runtime address of the symbol is unique within the process, so we
+    // use it as the key of the symbol name.
+    symbol.name = string_table.key(pc - (address - elf_symbol->address),
+                                   demangle(elf_symbol->name.c_str()));
+#elif defined PL_DARWIN
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(pc), &info) == 0 || info.dli_fname == NULL)
+        return ErrorKind::SymbolError;
+
+    symbol.module = string_table.key(reinterpret_cast<uintptr_t>(info.dli_fbase),
+                                     std::string("native@") + info.dli_fname);
+    symbol.offset = pc - reinterpret_cast<uintptr_t>(info.dli_fbase);
+
+    if (info.dli_sname != NULL && info.dli_saddr != NULL)
+        symbol.name =
+            string_table.key(reinterpret_cast<uintptr_t>(info.dli_saddr), demangle(info.dli_sname));
+#endif
+
+    return symbol;
+}
+
+// ----------------------------------------------------------------------------
+
+// We make this a reference to a heap-allocated object so that we can avoid
+// the destruction on exit. We are in charge of cleaning up the object. Note
+// that the object will leak, but this is not a problem.
+inline Symbolizer& symbolizer = *(new Symbolizer());
@@ -22,6 +22,11 @@
 #include <opcode.h>
 #endif  // PY_VERSION_HEX >= 0x30b0000
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <stack>
 #include <unordered_map>
@@ -47,6 +52,22 @@ class GenInfo
 public:
     typedef std::unique_ptr<GenInfo> Ptr;
 
+    // A cheap snapshot of the execution state of a coroutine, used to tell
+    // whether it has moved since we last looked at it.
+    struct State
+    {
+        PyObject* code = NULL;
+        int frame_state = 0;
+        intptr_t instr = 0;
+        PyObject* yf = NULL;
+
+        bool operator==(const State& other) const
+        {
+            return code == other.code && frame_state == other.frame_state &&
+                   instr == other.instr && yf == other.yf;
+        }
+    };
+
     PyObject* origin = NULL;
     PyObject* frame = NULL;
 
@@ -54,13 +75,86 @@ public:
 
     bool is_running = false;
 
+    State state;
+
     [[nodiscard]] static Result<GenInfo::Ptr> create(PyObject* gen_addr);
+    [[nodiscard]] static Result<State> read_state(PyObject* gen_addr);
     GenInfo(PyObject* origin, PyObject* frame, GenInfo::Ptr await, bool is_running)
         : origin(origin), frame(frame), await(std::move(await)), is_running(is_running) {
         
     }
+
+    [[nodiscard]] bool is_valid() const;
 };
 
+// ----------------------------------------------------------------------------
+inline Result<GenInfo::State> GenInfo::read_state(PyObject* gen_addr)
+{
+    PyGenObject gen;
+    if (copy_type(gen_addr, gen) || !PyCoro_CheckExact(&gen))
+        return ErrorKind::GenInfoError;
+
+    State state;
+
+#if PY_VERSION_HEX >= 0x030b0000
+    state.frame_state = gen.gi_frame_state;
+    if (gen.gi_frame_state != FRAME_CLEARED)
+    {
+        auto frame = (PyObject*)((char*)gen_addr + offsetof(PyGenObject, gi_iframe));
+        _PyInterpreterFrame iframe;
+        if (copy_type(frame, iframe))
+            return ErrorKind::GenInfoError;
+
+        state.yf = PyGen_yf(&gen, frame);
+
+#if PY_VERSION_HEX >= 0x030d0000
+        state.code = iframe.f_executable;
+        state.instr = (intptr_t)iframe.instr_ptr;
+#else
+        state.code = (PyObject*)iframe.f_code;
+        state.instr = (intptr_t)iframe.prev_instr;
+#endif
+    }
+#else
+    if (gen.gi_frame != NULL)
+    {
+        PyFrameObject f;
+        if (copy_type(gen.gi_frame, f))
+            return ErrorKind::GenInfoError;
+
+        state.code = (PyObject*)f.f_code;
+        state.instr = f.f_lasti;
+        state.yf = PyGen_yf(&gen, (PyObject*)gen.gi_frame);
+#if PY_VERSION_HEX >= 0x030a0000
+        state.frame_state = f.f_state;
+#else
+        state.frame_state = gen.gi_running;
+#endif
+    }
+#endif
+
+    return state;
+}
+
+// ----------------------------------------------------------------------------
+// Check that the coroutine chain is still in the state it was when we created
+// this object. This costs a few small copies per await level.
+inline bool GenInfo::is_valid() const
+{
+    for (auto gen = this; gen != nullptr; gen = gen->await.get())
+    {
+        // The stack of a running coroutine changes all the time.
+        if (gen->is_running)
+            return false;
+
+        auto maybe_state = read_state(gen->origin);
+        if (!maybe_state || !(*maybe_state == gen->state))
+            return false;
+    }
+
+    return true;
+}
+
 inline Result<GenInfo::Ptr> GenInfo::create(PyObject* gen_addr)
 {
     static thread_local size_t recursion_depth = 0;
@@ -80,6 +174,14 @@ inline Result<GenInfo::Ptr> GenInfo::create(PyObject* gen_addr)
 
     auto origin = gen_addr;
 
+    // Take the snapshot of the state first, so that any change that happens
+    // while we are reading the rest invalidates the object.
+    auto maybe_state = read_state(gen_addr);
+    if (!maybe_state) {
+        recursion_depth--;
+        return ErrorKind::GenInfoError;
+    }
+
 #if PY_VERSION_HEX >= 0x030b0000
     // The frame follows the generator object
     auto frame = (gen.gi_frame_state == FRAME_CLEARED)
@@ -95,7 +197,7 @@ inline Result<GenInfo::Ptr> GenInfo::create(PyObject* gen_addr)
         return ErrorKind::GenInfoError;
     }
 
-    PyObject* yf = (frame != NULL ? PyGen_yf(&gen, frame) : NULL);
+    PyObject* yf = maybe_state->yf;
     GenInfo::Ptr await = nullptr;
     if (yf != NULL && yf != gen_addr)
     {
@@ -114,7 +216,9 @@ inline Result<GenInfo::Ptr> GenInfo::create(PyObject* gen_addr)
 #endif
 
     recursion_depth--;
-    return std::make_unique<GenInfo>(origin, frame, std::move(await), is_running);
+    auto gen_info = std::make_unique<GenInfo>(origin, frame, std::move(await), is_running);
+    gen_info->state = *maybe_state;
+    return gen_info;
 }
 
 // ----------------------------------------------------------------------------
@@ -132,12 +236,15 @@ public:
 
     StringTable::Key name;
 
-    // Information to reconstruct the async stack as best as we can
-    TaskInfo::Ptr waiter = nullptr;
+    // Information to reconstruct the async stack as best as we can. This is
+    // the origin of the future the task is waiting on, which might be another
+    // task.
+    PyObject* waiter = NULL;
 
     [[nodiscard]] static Result<TaskInfo::Ptr> create(TaskObj*);
-    TaskInfo(PyObject* origin, PyObject* loop, GenInfo::Ptr coro, StringTable::Key name, TaskInfo::Ptr waiter)
-        : origin(origin), loop(loop), coro(std::move(coro)), name(name), waiter(std::move(waiter)) {
+    [[nodiscard]] static Result<TaskInfo::Ptr> create(TaskObj*, const TaskObj&);
+    TaskInfo(PyObject* origin, PyObject* loop, GenInfo::Ptr coro, StringTable::Key name, PyObject* waiter)
+        : origin(origin), loop(loop), coro(std::move(coro)), name(name), waiter(waiter) {
         
     }
 
@@ -145,29 +252,22 @@ public:
     inline size_t unwind(FrameStack&);
 };
 
-inline std::unordered_map<PyObject*, PyObject*> task_link_map;
-inline std::mutex task_link_map_lock;
-
 // ----------------------------------------------------------------------------
 inline Result<TaskInfo::Ptr> TaskInfo::create(TaskObj* task_addr)
 {
-    static thread_local size_t recursion_depth = 0;
-    recursion_depth++;
-
-    if (recursion_depth > MAX_RECURSION_DEPTH) {
-        recursion_depth--;
-        return ErrorKind::TaskInfoError;
-    }
-
     TaskObj task;
     if (copy_type(task_addr, task)) {
-        recursion_depth--;
         return ErrorKind::TaskInfoError;
     }
 
+    return TaskInfo::create(task_addr, task);
+}
+
+// ----------------------------------------------------------------------------
+inline Result<TaskInfo::Ptr> TaskInfo::create(TaskObj* task_addr, const TaskObj& task)
+{
     auto maybe_coro = GenInfo::create(task.task_coro);
     if (!maybe_coro) {
-        recursion_depth--;
         return ErrorKind::TaskInfoGeneratorError;
     }
 
@@ -175,24 +275,14 @@ inline Result<TaskInfo::Ptr> TaskInfo::create(TaskObj* task_addr)
 
     auto maybe_name = string_table.key(task.task_name);
     if (!maybe_name) {
-        recursion_depth--;
         return ErrorKind::TaskInfoError;
     }
 
     auto name = *maybe_name;
     auto loop = task.task_loop;
 
-    TaskInfo::Ptr waiter = nullptr;
-    if (task.task_fut_waiter)
-    {
-        auto maybe_waiter = TaskInfo::create((TaskObj*)task.task_fut_waiter);  // TODO: Make lazy?
-        if (maybe_waiter) {
-            waiter = std::move(*maybe_waiter);
-        }
-    }
-
-    recursion_depth--;
-    return std::make_unique<TaskInfo>(origin, loop, std::move(*maybe_coro), name, std::move(waiter));
+    return std::make_unique<TaskInfo>(origin, loop, std::move(*maybe_coro), name,
+                                      task.task_fut_waiter);
 }
 
 // ----------------------------------------------------------------------------
@@ -221,38 +311,79 @@ inline Result<TaskInfo::Ptr> TaskInfo::current(PyObject* loop)
     return TaskInfo::create((TaskObj*)task);
 }
 
+#if PY_VERSION_HEX >= 0x030e0000
 // ----------------------------------------------------------------------------
-// TODO: Make this a "for_each_task" function?
-[[nodiscard]] inline Result<std::vector<TaskInfo::Ptr>> get_all_tasks(PyObject* loop)
+// From Python 3.14, native tasks are kept in a circular doubly-linked list
+// whose head is in the state of the thread that created them. When a thread
+// terminates, its tasks are moved to a similar list in the interpreter state.
+[[nodiscard]] inline Result<void> for_each_task_in_list(void* head_addr,
+                                                        std::function<void(TaskObj*)>& callback)
 {
-    std::vector<TaskInfo::Ptr> tasks;
-    if (loop == NULL)
-        return tasks;
+    // A safety net against corrupted lists, e.g. while they are being updated.
+    constexpr size_t max_tasks = 1 << 22;
 
-    auto maybe_scheduled_tasks_set = MirrorSet::create(asyncio_scheduled_tasks);
-    if (!maybe_scheduled_tasks_set) {
+    struct llist_node node;
+    if (copy_type(head_addr, node))
         return ErrorKind::TaskInfoError;
+
+    size_t count = 0;
+    for (auto node_addr = node.next; node_addr != head_addr; node_addr = node.next)
+    {
+        if (node_addr == NULL || ++count > max_tasks || copy_type(node_addr, node))
+            return ErrorKind::TaskInfoError;
+
+        callback((TaskObj*)((char*)node_addr - offsetof(TaskObj, task_node)));
     }
 
-    auto scheduled_tasks_set = std::move(*maybe_scheduled_tasks_set);
-    auto maybe_scheduled_tasks = scheduled_tasks_set.as_unordered_set();
-    if (!maybe_scheduled_tasks) {
+    return Result<void>::ok();
+}
+#endif  // PY_VERSION_HEX >= 0x030e0000
+
+// ----------------------------------------------------------------------------
+[[nodiscard]] inline Result<void> for_each_task(PyThreadState* tstate_addr,
+                                                std::function<void(TaskObj*)> callback)
+{
+#if PY_VERSION_HEX >= 0x030e0000
+    if (tstate_addr != NULL)
+    {
+        auto thread_tasks_success = for_each_task_in_list(
+            (char*)tstate_addr + offsetof(_PyThreadStateImpl, asyncio_tasks_head), callback);
+        if (!thread_tasks_success) {
+            return ErrorKind::TaskInfoError;
+        }
+
+        PyInterpreterState* interp_addr = NULL;
+        if (!copy_type((char*)tstate_addr + offsetof(PyThreadState, interp), interp_addr) &&
+            interp_addr != NULL)
+        {
+            // This list is rarely populated and is protected by a lock that
+            // we cannot take, so we don't fail on it.
+            (void)for_each_task_in_list(
+                (char*)interp_addr + offsetof(PyInterpreterState, asyncio_tasks_head), callback);
+        }
+    }
+
+    // Tasks that are not native, like those implemented in pure Python, are
+    // still registered with the sets below.
+#else
+    (void)tstate_addr;
+#endif  // PY_VERSION_HEX >= 0x030e0000
+
+    auto maybe_scheduled_tasks_set = MirrorSet::create(asyncio_scheduled_tasks);
+    if (!maybe_scheduled_tasks_set) {
         return ErrorKind::TaskInfoError;
     }
 
-    auto scheduled_tasks = std::move(*maybe_scheduled_tasks);
-    for (auto task_wr_addr : scheduled_tasks)
-    {
+    auto scheduled_tasks_set = std::move(*maybe_scheduled_tasks_set);
+    auto scheduled_tasks_success = scheduled_tasks_set.for_each([&callback](PyObject* task_wr_addr) {
         PyWeakReference task_wr;
         if (copy_type(task_wr_addr, task_wr))
-            continue;
+            return;
 
-        auto maybe_task_info = TaskInfo::create((TaskObj*)task_wr.wr_object);
-        if (maybe_task_info) {
-            if ((*maybe_task_info)->loop == loop) {
-                tasks.push_back(std::move(*maybe_task_info));
-            }
-        }
+        callback((TaskObj*)task_wr.wr_object);
+    });
+    if (!scheduled_tasks_success) {
+        return ErrorKind::TaskInfoError;
     }
 
     if (asyncio_eager_tasks != NULL)
@@ -263,31 +394,311 @@ inline Result<TaskInfo::Ptr> TaskInfo::current(PyObject* loop)
         }
 
         auto eager_tasks_set = std::move(*maybe_eager_tasks_set);
+        auto eager_tasks_success = eager_tasks_set.for_each(
+            [&callback](PyObject* task_addr) { callback((TaskObj*)task_addr); });
+        if (!eager_tasks_success) {
+            return ErrorKind::TaskInfoError;
+        }
+    }
+
+    return Result<void>::ok();
+}
+
+// ----------------------------------------------------------------------------
+// A cache of the tasks of an event loop, indexed by task address. On each
+// update, the cached entries are validated cheaply against the task object
+// and the state of its coroutine chain, and only the tasks that are new or
+// that have changed are re-created. Tasks that are gone are dropped.
+class TaskCache
+{
+public:
+    // The tasks of the loop, as of the last update.
+    std::vector<TaskInfo::Ref> tasks;
+
+    // The tasks, of any loop, that have disappeared since the previous update.
+    std::vector<PyObject*> removed_tasks;
+
+    // ------------------------------------------------------------------------
+    bool contains(PyObject* task) const
+    {
+        return entries.find((TaskObj*)task) != entries.end();
+    }
+
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<void> update(PyObject* loop, PyThreadState* tstate_addr)
+    {
+        tasks.clear();
+        removed_tasks.clear();
+        if (loop == NULL)
+            return Result<void>::ok();
+
+        tick++;
+
+        auto for_each_task_success = for_each_task(tstate_addr, [this, loop](TaskObj* task_addr) {
+            TaskObj task;
+            if (copy_type(task_addr, task))
+                return;
+
+            auto& entry = entries[task_addr];
+            if (entry.seen == tick)
+                // Already seen in this update
+                return;
+            entry.seen = tick;
+
+            Entry::Key key = {task.task_loop, task.task_coro, task.task_name,
+                              task.task_fut_waiter, task.task_state};
+
+            // We keep track of the tasks of other loops too, but we don't
+            // need to know anything about them.
+            if (task.task_loop != loop)
+            {
+                entry.key = key;
+                entry.info = nullptr;
+                return;
+            }
+
+            if (entry.info == nullptr || !(entry.key == key) || !entry.info->coro->is_valid())
+            {
+                auto maybe_task_info = TaskInfo::create(task_addr, task);
+                if (!maybe_task_info)
+                {
+                    entry.info = nullptr;
+                    return;
+                }
+
+                entry.key = key;
+                entry.info = std::move(*maybe_task_info);
+            }
 
-        auto maybe_eager_tasks = eager_tasks_set.as_unordered_set();
-        if (!maybe_eager_tasks) {
+            tasks.push_back(std::ref(*entry.info));
+        });
+        if (!for_each_task_success)
+        {
+            tasks.clear();
             return ErrorKind::TaskInfoError;
         }
 
-        auto eager_tasks = std::move(*maybe_eager_tasks);
-        for (auto task_addr : eager_tasks)
+        // Drop the tasks that no longer exist.
+        for (auto it = entries.begin(); it != entries.end();)
         {
-            auto maybe_task_info = TaskInfo::create((TaskObj*)task_addr);
-            if (maybe_task_info) {
-                if ((*maybe_task_info)->loop == loop) {
-                    tasks.push_back(std::move(*maybe_task_info));
-                }
+            if (it->second.seen != tick)
+            {
+                removed_tasks.push_back((PyObject*)it->first);
+                it = entries.erase(it);
             }
+            else
+                ++it;
         }
+
+        return Result<void>::ok();
     }
 
-    return tasks;
-}
+private:
+    struct Entry
+    {
+        struct Key
+        {
+            PyObject* loop = NULL;
+            PyObject* coro = NULL;
+            PyObject* name = NULL;
+            PyObject* waiter = NULL;
+            int state = 0;
+
+            bool operator==(const Key& other) const
+            {
+                return loop == other.loop && coro == other.coro && name == other.name &&
+                       waiter == other.waiter && state == other.state;
+            }
+        } key;
+
+        TaskInfo::Ptr info = nullptr;
+        uint64_t seen = 0;
+    };
+
+    std::unordered_map<TaskObj*, Entry> entries;
+    uint64_t tick = 0;
+};
+
+// ----------------------------------------------------------------------------
+// The maximum number of task links that can wait to be read by the sampler.
+// This only matters when the sampler does not read them, e.g. because there is
+// no event loop to sample, in which case we drop the oldest ones.
+inline constexpr size_t TASK_LINKS_MAX_PENDING = 1 << 16;
+
+// ----------------------------------------------------------------------------
+// The links between tasks that cannot be recovered from the task objects
+// themselves, e.g. the ones created by gather. New links are added to a log by
+// the Python threads, which the sampler drains only when it is not empty. The
+// sampler reads the links from an immutable snapshot, which is only rebuilt
+// when something has changed.
+class TaskLinkMap
+{
+public:
+    struct Snapshot
+    {
+        // Indexed by child task origin
+        std::unordered_map<PyObject*, PyObject*> links;
+
+        // The number of children of each parent task
+        std::unordered_map<PyObject*, size_t> parents;
+    };
+
+    // ------------------------------------------------------------------------
+    void link(PyObject* parent, PyObject* child)
+    {
+        link(parent, &child, 1);
+    }
+
+    // ------------------------------------------------------------------------
+    void link(PyObject* parent, PyObject* const* children, size_t count)
+    {
+        // The links are dropped when the sampler stops, so there is no point
+        // in recording them until it starts again.
+        if (!running)
+            return;
+
+        // The links are created by the thread that runs the event loop of the
+        // tasks, so only the task cache of that thread can tell whether the
+        // child task exists.
+        uintptr_t owner = PyThread_get_thread_ident();
+
+        std::lock_guard<std::mutex> guard(pending_lock);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (pending.size() >= TASK_LINKS_MAX_PENDING)
+                pending.pop_front();
+            pending.push_back({children[i], parent, owner, false});
+        }
+        has_pending.store(true, std::memory_order_release);
+    }
+
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(update_lock);
+        std::lock_guard<std::mutex> pending_guard(pending_lock);
+
+        pending.clear();
+        has_pending.store(false, std::memory_order_relaxed);
+        deferred.clear();
+        current = std::make_shared<Snapshot>();
+    }
+
+    // ------------------------------------------------------------------------
+    // Bring the links up to date with the task cache of the given thread and
+    // return them. The links created by other threads are kept for when their
+    // own task caches are available.
+    std::shared_ptr<const Snapshot> snapshot(const TaskCache& cache, uintptr_t thread_id)
+    {
+        std::lock_guard<std::mutex> guard(update_lock);
+
+        std::vector<Op> ops;
+        std::swap(ops, deferred);
+        if (has_pending.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> pending_guard(pending_lock);
+
+            ops.insert(ops.end(), pending.begin(), pending.end());
+            pending.clear();
+            has_pending.store(false, std::memory_order_relaxed);
+        }
+
+        auto others = std::stable_partition(
+            ops.begin(), ops.end(), [thread_id](const Op& op) { return op.owner == thread_id; });
+        deferred.assign(others, ops.end());
+        ops.erase(others, ops.end());
+
+        // The links of a thread that is not sampled are never read, so we
+        // only keep the most recent ones.
+        if (deferred.size() > TASK_LINKS_MAX_PENDING)
+            deferred.erase(deferred.begin(), deferred.end() - TASK_LINKS_MAX_PENDING);
+
+        bool changed = !ops.empty();
+        for (auto task : cache.removed_tasks)
+        {
+            if (changed)
+                break;
+            changed = current->links.count(task) || current->parents.count(task);
+        }
+        if (!changed)
+            return current;
+
+        auto next = std::make_shared<Snapshot>(*current);
+
+        for (auto task : cache.removed_tasks)
+        {
+            unlink(*next, task);
+
+            // The children of a completed parent will not be around for long,
+            // but we stop treating it as a parent right away.
+            next->parents.erase(task);
+        }
+
+        for (auto& op : ops)
+        {
+            if (!cache.contains(op.child))
+            {
+                // The child task might have been created after the cache was
+                // last updated, so we give it another chance. Otherwise it
+                // has completed already.
+                if (!op.retried)
+                    deferred.push_back({op.child, op.parent, op.owner, true});
+                continue;
+            }
+
+            unlink(*next, op.child);
+            next->links[op.child] = op.parent;
+            next->parents[op.parent]++;
+        }
+
+        current = std::move(next);
+
+        return current;
+    }
+
+private:
+    struct Op
+    {
+        PyObject* child;
+        PyObject* parent;
+        uintptr_t owner;
+        bool retried;
+    };
+
+    std::mutex pending_lock;
+    std::deque<Op> pending;
+    std::atomic<bool> has_pending = false;
+
+    std::mutex update_lock;
+    std::vector<Op> deferred;
+    std::shared_ptr<const Snapshot> current = std::make_shared<Snapshot>();
+
+    // ------------------------------------------------------------------------
+    static void unlink(Snapshot& snapshot, PyObject* child)
+    {
+        auto link = snapshot.links.find(child);
+        if (link == snapshot.links.end())
+            return;
+
+        auto parent = snapshot.parents.find(link->second);
+        if (parent != snapshot.parents.end() && --parent->second == 0)
+            snapshot.parents.erase(parent);
+
+        snapshot.links.erase(link);
+    }
+};
+
+inline TaskLinkMap task_link_map;
 
 // ----------------------------------------------------------------------------
 
 inline std::vector<std::unique_ptr<StackInfo>> current_tasks;
 
+// The frames of the current task stacks. The stacks in current_tasks are spans
+// over this buffer.
+inline FrameBuffer current_tasks_frames;
+
 // ----------------------------------------------------------------------------
 
 inline size_t TaskInfo::unwind(FrameStack& stack)
@@ -10,8 +10,12 @@
 #include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <iostream>
 #include <mutex>
+#include <random>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #if defined PL_LINUX
 #include <time.h>
@@ -23,6 +27,8 @@
 #include <echion/errors.h>
 #include <echion/greenlets.h>
 #include <echion/interp.h>
+#include <echion/loops.h>
+#include <echion/perf.h>
 #include <echion/render.h>
 #include <echion/signals.h>
 #include <echion/stacks.h>
@@ -48,11 +54,38 @@ public:
 
     uintptr_t asyncio_loop = 0;
 
+    // The statistics of the ready queue of the event loop, if any.
+    LoopStats loop_stats;
+
+    // Whether the event loop was found waiting for I/O at the last sample.
+    bool loop_idle = false;
+
+    // The asyncio tasks of the thread's event loop, as of the last sample.
+    TaskCache task_cache;
+
+    // Used to pick the idle tasks to unwind, when tasks are sampled.
+    std::minstd_rand task_rng{std::random_device{}()};
+
+    // The address of the thread state of the thread, as last seen.
+    PyThreadState* tstate_addr = NULL;
+
+    // The stacks collected by the thread in native mode, if any.
+    NativeSampleSlot* native_sample = nullptr;
+
+#ifdef PERF_NATIVE_SUPPORTED
+    // The perf event used to sample the native stack, if any.
+    PerfSampler::Ptr perf = nullptr;
+    bool perf_failed = false;
+#endif  // PERF_NATIVE_SUPPORTED
+
     [[nodiscard]] Result<void> update_cpu_time();
     bool is_running();
 
-    [[nodiscard]] Result<void> sample(int64_t, PyThreadState*, microsecond_t);
+    [[nodiscard]] Result<void> sample(int64_t, PyThreadState*, microsecond_t, bool = false);
     void unwind(PyThreadState*);
+#ifdef PERF_NATIVE_SUPPORTED
+    bool open_perf();
+#endif  // PERF_NATIVE_SUPPORTED
 
     // ------------------------------------------------------------------------
 #if defined PL_LINUX
@@ -94,6 +127,10 @@ public:
 
 private:
     [[nodiscard]] Result<void> unwind_tasks();
+    bool is_loop_idle();
+#ifdef PERF_NATIVE_SUPPORTED
+    void unwind_perf();
+#endif  // PERF_NATIVE_SUPPORTED
     void unwind_greenlets(PyThreadState*, unsigned long);
 };
 
@@ -179,28 +216,53 @@ inline std::mutex thread_info_map_lock;
 // ----------------------------------------------------------------------------
 inline void ThreadInfo::unwind(PyThreadState* tstate)
 {
-    if (native)
-    {
-        // Lock on the signal handler. Will get unlocked once the handler is
-        // done unwinding the native stack.
-        const std::lock_guard<std::mutex> guard(sigprof_handler_lock);
-
-        // Pass the current thread state to the signal handler. This is needed
-        // to unwind the Python stack from within it.
-        current_tstate = tstate;
+    loop_idle = false;
 
-        // Send a signal to the thread to unwind its native stack.
-        pthread_kill((pthread_t)tstate->thread_id, SIGPROF);
-
-        // Lock to wait for the signal handler to finish unwinding the native
-        // stack. Release the lock immediately after so that it is available
-        // for the next thread.
-        sigprof_handler_lock.lock();
+    if (native && !native_leaf)
+    {
+        // The stacks have been collected by the thread itself from within the
+        // signal handler (see for_each_thread_native). Here we just resolve
+        // them to actual frames.
+        if (native_sample != nullptr)
+        {
+            native_sample->resolve();
+        }
+#ifdef PERF_NATIVE_SUPPORTED
+        else if (native_perf)
+        {
+            // The Python stack is read from the sampler thread, after the
+            // native stack was sampled by the kernel, so the two might not
+            // match (see interleave_stacks).
+            unwind_python_stack(tstate);
+            unwind_perf();
+        }
+#endif  // PERF_NATIVE_SUPPORTED
+        else
+        {
+            python_stack.clear();
+            native_stack.clear();
+        }
     }
     else
     {
+        if (native_leaf)
+        {
+            // In leaf mode we only collect the top native frames, which are
+            // then attached to the Python stack that we unwind as usual.
+            if (native_sample != nullptr)
+                native_sample->resolve();
+            else
+                native_stack.clear();
+        }
+
         unwind_python_stack(tstate);
-        if (asyncio_loop)
+
+        // An event loop that is waiting for I/O has no running tasks, so we
+        // can avoid the cost of unwinding them all and report the thread
+        // stack as idle instead.
+        loop_idle = idle && asyncio_loop && is_loop_idle();
+
+        if (asyncio_loop && !loop_idle)
         {
             auto unwind_tasks_success = unwind_tasks();
             if (!unwind_tasks_success) {
@@ -215,100 +277,230 @@ inline void ThreadInfo::unwind(PyThreadState* tstate)
     }
 }
 
+// ----------------------------------------------------------------------------
+inline bool ThreadInfo::is_loop_idle()
+{
+    // The event loop waits for I/O events in BaseEventLoop._run_once, by
+    // calling the select method of its selector (or of the proactor on
+    // Windows). The actual wait happens in C code, so the selector method is
+    // the top Python frame. With Python < 3.11 we only have the bare function
+    // names, so we match on the suffix.
+    if (python_stack.size() < 2)
+        return false;
+
+    auto name_ends_with = [](const Frame& frame, std::string_view suffix) {
+        auto maybe_name = string_table.lookup(frame.name);
+        if (!maybe_name)
+            return false;
+
+        std::string_view name = **maybe_name;
+        return name.size() >= suffix.size() &&
+               name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+
+    return name_ends_with(python_stack[0].get(), "select") &&
+           name_ends_with(python_stack[1].get(), "_run_once");
+}
+
+// ----------------------------------------------------------------------------
+#ifdef PERF_NATIVE_SUPPORTED
+inline bool ThreadInfo::open_perf()
+{
+    if (perf == nullptr && !perf_failed)
+    {
+        auto maybe_perf = PerfSampler::create(static_cast<pid_t>(native_id));
+        if (maybe_perf)
+            perf = std::move(*maybe_perf);
+        else
+        {
+            // This usually happens when the rings of the other threads have
+            // used up the memory that we are allowed to lock (see
+            // kernel.perf_event_mlock_kb). We don't try again for this thread
+            // and sample it with signals instead.
+            perf_failed = true;
+
+            static bool warned = false;
+            if (!warned)
+            {
+                std::cerr << "Failed to open a perf event for a thread, falling back to signals "
+                             "for native stack sampling of the threads without one"
+                          << std::endl;
+                warned = true;
+            }
+        }
+    }
+
+    return perf != nullptr;
+}
+
+// ----------------------------------------------------------------------------
+inline void ThreadInfo::unwind_perf()
+{
+    native_stack.clear();
+    if (perf == nullptr)
+        return;
+
+    unw_word_t pcs[MAX_NATIVE_FRAMES];
+    auto count = perf->unwind(pcs, MAX_NATIVE_FRAMES);
+
+    // If the thread has not been on CPU since the last sample we only report
+    // its Python stack.
+    resolve_native_stack(pcs, count);
+}
+#endif  // PERF_NATIVE_SUPPORTED
+
+// ----------------------------------------------------------------------------
+// Find the frame with the given address in the thread stack, starting from the
+// root, and return its index.
+static Result<size_t> find_thread_frame(PyObject* frame_addr)
+{
+    for (size_t i = python_stack_addrs.size(); i-- > 0;)
+    {
+        if (python_stack_addrs[i] == frame_addr)
+            return i;
+    }
+
+    return ErrorKind::FrameError;
+}
+
 // ----------------------------------------------------------------------------
 inline Result<void> ThreadInfo::unwind_tasks()
 {
     std::vector<TaskInfo::Ref> leaf_tasks;
-    std::unordered_set<PyObject*> parent_tasks;
     std::unordered_map<PyObject*, TaskInfo::Ref> waitee_map;  // Indexed by task origin
     std::unordered_map<PyObject*, TaskInfo::Ref> origin_map;  // Indexed by task origin
 
-    auto maybe_all_tasks = get_all_tasks((PyObject*)asyncio_loop);
-    if (!maybe_all_tasks) {
+    auto update_success = task_cache.update((PyObject*)asyncio_loop, tstate_addr);
+    if (!update_success) {
         return ErrorKind::TaskInfoError;
     }
 
-    auto all_tasks = std::move(*maybe_all_tasks);
-    {
-        std::lock_guard<std::mutex> lock(task_link_map_lock);
-
-        // Clean up the task_link_map. Remove entries associated to tasks that
-        // no longer exist.
-        std::unordered_set<PyObject*> all_task_origins;
-        std::transform(all_tasks.cbegin(), all_tasks.cend(),
-                       std::inserter(all_task_origins, all_task_origins.begin()),
-                       [](const TaskInfo::Ptr& task) { return task->origin; });
+    auto& all_tasks = task_cache.tasks;
 
-        std::vector<PyObject*> to_remove;
-        for (auto kv : task_link_map)
-        {
-            if (all_task_origins.find(kv.first) == all_task_origins.end())
-                to_remove.push_back(kv.first);
-        }
-        for (auto key : to_remove)
-            task_link_map.erase(key);
-
-        // Determine the parent tasks from the gather links.
-        std::transform(task_link_map.cbegin(), task_link_map.cend(),
-                       std::inserter(parent_tasks, parent_tasks.begin()),
-                       [](const std::pair<PyObject*, PyObject*>& kv) { return kv.second; });
-    }
+    // The gather links, and the parent tasks they determine
+    auto links = task_link_map.snapshot(task_cache, thread_id);
+    auto& parent_tasks = links->parents;
 
     for (auto& task : all_tasks)
+        origin_map.emplace(task.get().origin, task);
+
+    for (auto& task_ref : all_tasks)
     {
-        origin_map.emplace(task->origin, std::ref(*task));
+        auto& task = task_ref.get();
 
-        if (task->waiter != NULL)
-            waitee_map.emplace(task->waiter->origin, std::ref(*task));
-        else if (parent_tasks.find(task->origin) == parent_tasks.end())
+        // A task that waits on a future that is not one of the known tasks
+        // is a leaf task.
+        if (task.waiter != NULL && origin_map.find(task.waiter) != origin_map.end())
+            waitee_map.emplace(task.waiter, task_ref);
+        else if (parent_tasks.find(task.origin) == parent_tasks.end())
         {
-            if (cpu && ignore_non_running_threads && !task->coro->is_running)
+            if (cpu && ignore_non_running_threads && !task.coro->is_running)
             {
                 // This task is not running, so we skip it if we are
                 // interested in just CPU time.
                 continue;
             }
-            leaf_tasks.push_back(std::ref(*task));
+            leaf_tasks.push_back(task_ref);
         }
     }
 
-    for (auto& task : leaf_tasks)
+    // With many tasks, we only unwind a random sample of the idle leaf tasks,
+    // and scale their metrics by the inverse of the sampling probability. The
+    // running tasks are always unwound.
+    double idle_weight = 1.0;
+    if (task_sample_size > 0)
     {
-        bool on_cpu = task.get().coro->is_running;
-        auto stack_info = std::make_unique<StackInfo>(task.get().name, on_cpu);
-        auto& stack = stack_info->stack;
-        for (auto current_task = task;;)
+        auto idle_begin =
+            std::partition(leaf_tasks.begin(), leaf_tasks.end(),
+                           [](const TaskInfo::Ref& task) { return task.get().coro->is_running; });
+        size_t running_count = idle_begin - leaf_tasks.begin();
+        size_t idle_count = leaf_tasks.size() - running_count;
+
+        if (idle_count > task_sample_size)
         {
-            auto& task = current_task.get();
+            // Partial Fisher-Yates shuffle of the idle tasks
+            for (size_t i = 0; i < task_sample_size; i++)
+            {
+                std::uniform_int_distribution<size_t> pick(i, idle_count - 1);
+                std::swap(idle_begin[i], idle_begin[pick(task_rng)]);
+            }
 
-            size_t stack_size = task.unwind(stack);
+            leaf_tasks.erase(idle_begin + task_sample_size, leaf_tasks.end());
+            idle_weight = static_cast<double>(idle_count) / task_sample_size;
+        }
+    }
+
+    auto& buffer = current_tasks_frames;
+    buffer.clear();
+
+    // The stack of each task, without the stacks of the tasks that await on
+    // it, indexed by task origin. These are shared by all the leaf tasks that
+    // have a task in common in their chains.
+    std::unordered_map<PyObject*, FrameSpan> task_spans;
 
-            if (on_cpu)
+    // The frames of a running task are on the thread stack, from the leaf (or
+    // from the running task that it awaits on) down to its outermost
+    // coroutine frame. We locate the latter by address.
+    std::vector<std::pair<size_t, TaskInfo*>> running_tasks;
+    for (auto& task_ref : all_tasks)
+    {
+        auto& task = task_ref.get();
+        if (!task.coro->is_running || task.coro->frame == NULL)
+            continue;
+
+        auto maybe_index = find_thread_frame(task.coro->frame);
+        if (maybe_index)
+            running_tasks.emplace_back(*maybe_index, &task);
+        else
+        {
+            // The frames of the task are on the thread stack, but we don't
+            // know where, e.g. because the stack changed between the reads.
+            // We keep them where they are rather than unwinding them again.
+            FrameSpan span = {buffer.size(), 0};
+            buffer.extend(span, Frame::get(task.name));
+            task_spans.emplace(task.origin, span);
+        }
+    }
+    std::sort(running_tasks.begin(), running_tasks.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    size_t thread_stack_start = 0;
+    for (auto& [index, task] : running_tasks)
+    {
+        auto span = buffer.append(python_stack, thread_stack_start, index + 1 - thread_stack_start);
+        buffer.extend(span, Frame::get(task->name));
+        task_spans.emplace(task->origin, span);
+        thread_stack_start = index + 1;
+    }
+
+    // The rest of the thread stack is shared by all the task stacks.
+    auto thread_span = buffer.append(python_stack, thread_stack_start);
+
+    FrameStack task_stack;
+    for (auto& leaf_task : leaf_tasks)
+    {
+        bool on_cpu = leaf_task.get().coro->is_running;
+        auto stack_info = std::make_unique<StackInfo>(leaf_task.get().name, on_cpu);
+        stack_info->weight = on_cpu ? 1.0 : idle_weight;
+        auto& spans = stack_info->spans;
+        for (auto current_task = leaf_task;;)
+        {
+            auto& task = current_task.get();
+
+            auto task_span = task_spans.find(task.origin);
+            if (task_span == task_spans.end())
             {
-                // Undo the stack unwinding
-                // TODO[perf]: not super-efficient :(
-                for (size_t i = 0; i < stack_size; i++)
-                    stack.pop_back();
-
-                // Instead we get part of the thread stack
-                FrameStack temp_stack;
-                size_t nframes =
-                    (python_stack.size() > stack_size) ? python_stack.size() - stack_size : 0;
-                for (size_t i = 0; i < nframes; i++)
-                {
-                    auto python_frame = python_stack.front();
-                    temp_stack.push_front(python_frame);
-                    python_stack.pop_front();
-                }
-                while (!temp_stack.empty())
-                {
-                    stack.push_front(temp_stack.front());
-                    temp_stack.pop_front();
-                }
+                // Unwind the coroutine frames and add the task name frame
+                task_stack.clear();
+                task.unwind(task_stack);
+
+                auto span = buffer.append(task_stack);
+                buffer.extend(span, Frame::get(task.name));
+
+                task_span = task_spans.emplace(task.origin, span).first;
             }
 
-            // Add the task name frame
-            stack.push_back(Frame::get(task.name));
+            spans.push_back(task_span->second);
 
             // Get the next task in the chain
             PyObject* task_origin = task.origin;
@@ -318,14 +510,14 @@ inline Result<void> ThreadInfo::unwind_tasks()
                 continue;
             }
 
+            // Check for, e.g., gather links
+            auto link = links->links.find(task_origin);
+            if (link != links->links.end())
             {
-                // Check for, e.g., gather links
-                std::lock_guard<std::mutex> lock(task_link_map_lock);
-
-                if (task_link_map.find(task_origin) != task_link_map.end() &&
-                    origin_map.find(task_link_map[task_origin]) != origin_map.end())
+                auto parent = origin_map.find(link->second);
+                if (parent != origin_map.end())
                 {
-                    current_task = origin_map.find(task_link_map[task_origin])->second;
+                    current_task = parent->second;
                     continue;
                 }
             }
@@ -334,8 +526,7 @@ inline Result<void> ThreadInfo::unwind_tasks()
         }
 
         // Finish off with the remaining thread stack
-        for (auto p = python_stack.begin(); p != python_stack.end(); p++)
-            stack.push_back(*p);
+        spans.push_back(thread_span);
 
         current_tasks.push_back(std::move(stack_info));
     }
@@ -346,81 +537,98 @@ inline Result<void> ThreadInfo::unwind_tasks()
 // ----------------------------------------------------------------------------
 inline void ThreadInfo::unwind_greenlets(PyThreadState* tstate, unsigned long native_id)
 {
-    const std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
-
-    if (greenlet_thread_map.find(native_id) == greenlet_thread_map.end())
-        return;
-
-    std::unordered_set<GreenletInfo::ID> parent_greenlets;
+    // A greenlet in a leaf chain, as seen under the lock.
+    struct ChainLink
+    {
+        PyObject* frame;
+        StringTable::Key name;
+    };
 
-    // Collect all parent greenlets
-    std::transform(
-        greenlet_parent_map.cbegin(), greenlet_parent_map.cend(),
-        std::inserter(parent_greenlets, parent_greenlets.begin()),
-        [](const std::pair<GreenletInfo::ID, GreenletInfo::ID>& kv) { return kv.second; });
+    // The leaf chains are copied under the lock and unwound after releasing
+    // it, so that we don't block the greenlet tracer while we read the frames.
+    // The frames might change in the meantime, but all the reads are safe.
+    std::vector<std::pair<bool, std::vector<ChainLink>>> chains;
 
-    // Unwind the leaf greenlets
-    for (auto& greenlet_info : greenlet_info_map)
     {
-        auto greenlet_id = greenlet_info.first;
-        auto& greenlet = greenlet_info.second;
+        const std::lock_guard<std::mutex> guard(greenlet_info_map_lock);
 
-        if (parent_greenlets.find(greenlet_id) != parent_greenlets.end())
-            continue;
+        auto leaves = greenlet_thread_leaves.find(native_id);
+        if (leaves == greenlet_thread_leaves.end())
+            return;
 
-        auto frame = greenlet->frame;
-        if (frame == FRAME_NOT_SET)
+        for (auto greenlet_id : leaves->second)
         {
-            // The greenlet has not been started yet or has finished
-            continue;
-        }
+            auto entry = greenlet_info_map.find(greenlet_id);
+            if (entry == greenlet_info_map.end())
+                continue;
 
-        bool on_cpu = frame == Py_None;
-        if (cpu && ignore_non_running_threads && !on_cpu)
-        {
-            // Only the currently-running greenlet has a None in its frame
-            // cell. If we are interested in CPU time, we skip all greenlets
-            // that have an actual frame, as they are not running.
-            continue;
-        }
+            auto& greenlet = entry->second;
 
-        auto stack_info = std::make_unique<StackInfo>(greenlet->name, on_cpu);
-        auto& stack = stack_info->stack;
+            auto frame = greenlet->frame;
+            if (frame == FRAME_NOT_SET)
+            {
+                // The greenlet has not been started yet or has finished
+                continue;
+            }
 
-        greenlet->unwind(frame, tstate, stack);
+            bool on_cpu = frame == Py_None;
+            if (cpu && ignore_non_running_threads && !on_cpu)
+            {
+                // Only the currently-running greenlet has a None in its frame
+                // cell. If we are interested in CPU time, we skip all greenlets
+                // that have an actual frame, as they are not running.
+                continue;
+            }
 
-        // Unwind the parent greenlets
-        for (;;)
-        {
-            auto parent_greenlet_info = greenlet_parent_map.find(greenlet_id);
-            if (parent_greenlet_info == greenlet_parent_map.end())
-                break;
+            auto& chain = chains.emplace_back(on_cpu, std::vector<ChainLink>()).second;
+            chain.push_back({frame, greenlet->name});
+
+            // Collect the parent greenlets
+            for (;;)
+            {
+                auto parent_greenlet_info = greenlet_parent_map.find(greenlet_id);
+                if (parent_greenlet_info == greenlet_parent_map.end())
+                    break;
 
-            auto parent_greenlet_id = parent_greenlet_info->second;
+                auto parent_greenlet_id = parent_greenlet_info->second;
 
-            auto parent_greenlet = greenlet_info_map.find(parent_greenlet_id);
-            if (parent_greenlet == greenlet_info_map.end())
-                break;
+                auto parent_greenlet = greenlet_info_map.find(parent_greenlet_id);
+                if (parent_greenlet == greenlet_info_map.end())
+                    break;
 
-            auto parent_frame = parent_greenlet->second->frame;
-            if (parent_frame == FRAME_NOT_SET || parent_frame == Py_None)
-                break;
+                auto parent_frame = parent_greenlet->second->frame;
+                if (parent_frame == FRAME_NOT_SET || parent_frame == Py_None)
+                    break;
 
-            parent_greenlet->second->unwind(parent_frame, tstate, stack);
+                chain.push_back({parent_frame, parent_greenlet->second->name});
 
-            // Move up the greenlet chain
-            greenlet_id = parent_greenlet_id;
+                // Move up the greenlet chain
+                greenlet_id = parent_greenlet_id;
+            }
         }
+    }
+
+    for (auto& [on_cpu, chain] : chains)
+    {
+        auto stack_info = std::make_unique<StackInfo>(chain.front().name, on_cpu);
+        auto& stack = stack_info->stack;
+
+        for (auto& link : chain)
+            GreenletInfo::unwind(link.frame, link.name, tstate, stack);
 
         current_greenlets.push_back(std::move(stack_info));
     }
 }
 
 // ----------------------------------------------------------------------------
-inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, microsecond_t delta)
+inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, microsecond_t delta,
+                                       bool collecting)
 {
     Renderer::get().render_thread_begin(tstate, name, delta, thread_id, native_id);
 
+    if (loop_stats.ready != NULL)
+        loop_stats.update(gettime());
+
     if (cpu)
     {
         microsecond_t previous_cpu_time = cpu_time;
@@ -449,20 +657,25 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
         // so if we don't skip here we would have a double print.
         if (current_greenlets.empty())
         {
+            // We interleave the stacks first, so that we don't emit anything
+            // for a sample that we drop.
+            if (native && !interleave_stacks()) {
+                return ErrorKind::ThreadInfoError;
+            }
+
             // Print the PID and thread name
             Renderer::get().render_stack_begin(pid, iid, name);
             // Print the stack
             if (native)
-            {
-                if (!interleave_stacks()) {
-                    return ErrorKind::ThreadInfoError;
-                }
-
                 interleaved_stack.render();
-            }
             else
                 python_stack.render();
 
+            if (loop_idle)
+                Renderer::get().render_idle();
+            if (collecting)
+                Renderer::get().render_gc();
+
             Renderer::get().render_stack_end(MetricType::Time, delta);
         }
     }
@@ -478,20 +691,30 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
             auto task_name = *maybe_task_name;
             Renderer::get().render_task_begin(*task_name, task_stack_info->on_cpu);
             Renderer::get().render_stack_begin(pid, iid, name);
-            if (native)
+            // In leaf mode, the native frames only belong to the running task.
+            if (native && (!native_leaf || task_stack_info->on_cpu))
             {
                 // NOTE: These stacks might be non-sensical, especially with
                 // Python < 3.11.
-                if (!interleave_stacks(task_stack_info->stack)) {
+                auto& stack = task_stack_info->stack;
+                task_stack_info->spans.materialize(current_tasks_frames, stack);
+                if (!interleave_stacks(stack)) {
                     return ErrorKind::ThreadInfoError;
                 }
 
                 interleaved_stack.render();
             }
             else
-                task_stack_info->stack.render();
+                task_stack_info->spans.render(current_tasks_frames);
 
-            Renderer::get().render_stack_end(MetricType::Time, delta);
+            // The collection was triggered by the running task.
+            if (collecting && task_stack_info->on_cpu)
+                Renderer::get().render_gc();
+
+            auto weight = task_stack_info->weight;
+            Renderer::get().render_stack_end(
+                MetricType::Time,
+                weight == 1.0 ? delta : static_cast<microsecond_t>(delta * weight + 0.5));
         }
 
         current_tasks.clear();
@@ -512,7 +735,7 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
             Renderer::get().render_stack_begin(pid, iid, name);
 
             auto& stack = greenlet_stack->stack;
-            if (native)
+            if (native && (!native_leaf || greenlet_stack->on_cpu))
             {
                 // NOTE: These stacks might be non-sensical, especially with
                 // Python < 3.11.
@@ -525,6 +748,9 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
             else
                 stack.render();
 
+            if (collecting && greenlet_stack->on_cpu)
+                Renderer::get().render_gc();
+
             Renderer::get().render_stack_end(MetricType::Time, delta);
         }
 
@@ -608,8 +834,86 @@ static void for_each_thread(InterpreterInfo& interp,
                 thread_info_map.emplace(tstate.thread_id, std::move(*maybe_thread_info));
             }
 
+            auto& thread_info = *thread_info_map.find(tstate.thread_id)->second;
+            thread_info.tstate_addr = tstate_addr;
+
             // Call back with the thread state and thread info.
-            callback(&tstate, *thread_info_map.find(tstate.thread_id)->second);
+            callback(&tstate, thread_info);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// In native mode, we signal all the threads of the interpreter at once, so
+// that they can collect their own stacks concurrently, and then call back for
+// each thread that responded in time, with the collected stacks attached to
+// the thread info. With perf events, we only signal the threads for which we
+// could not open one.
+static void for_each_thread_native(InterpreterInfo& interp,
+                                   std::function<void(PyThreadState*, ThreadInfo&)> callback)
+{
+    struct ThreadSample
+    {
+        PyThreadState* tstate_addr;
+        uintptr_t thread_id;
+        NativeSampleSlot* slot;
+    };
+
+    const std::lock_guard<std::mutex> guard(native_sample_slots.lock);
+
+    native_sample_slots.begin_batch();
+
+    std::vector<ThreadSample> samples;
+    std::vector<NativeSampleSlot*> requested;
+
+    for_each_thread(interp, [&](PyThreadState* tstate, ThreadInfo& thread) {
+#ifdef PERF_NATIVE_SUPPORTED
+        if (native_perf && thread.open_perf())
+        {
+            // The native stack is sampled by the kernel.
+            samples.push_back({thread.tstate_addr, tstate->thread_id, nullptr});
+            return;
         }
+#endif  // PERF_NATIVE_SUPPORTED
+
+        auto slot = native_sample_slots.request(thread.thread_id, thread.tstate_addr);
+        if (slot == nullptr)
+            return;
+
+        samples.push_back({thread.tstate_addr, tstate->thread_id, slot});
+        requested.push_back(slot);
+    });
+
+    // We don't want to hold up the sampler for too long if a thread cannot
+    // handle the signal in a timely fashion.
+    native_sample_slots.wait(requested, std::max<microsecond_t>(interval, 1000));
+
+    for (auto& sample : samples)
+    {
+        if (sample.slot != nullptr &&
+            std::find(requested.begin(), requested.end(), sample.slot) == requested.end())
+            // Timed out, or the handler failed
+            continue;
+
+        // Take a fresh copy of the thread state, since the thread has moved
+        // on while we were waiting for the signal handlers.
+        PyThreadState tstate;
+        if (!copy_type(sample.tstate_addr, tstate) && tstate.thread_id == sample.thread_id)
+        {
+            const std::lock_guard<std::mutex> guard(thread_info_map_lock);
+
+            auto it = thread_info_map.find(sample.thread_id);
+            if (it != thread_info_map.end())
+            {
+                auto& thread = *it->second;
+
+                thread.native_sample = sample.slot;
+                callback(&tstate, thread);
+                thread.native_sample = nullptr;
+            }
+        }
+
+        if (sample.slot != nullptr)
+            native_sample_slots.release(sample.slot);
     }
 }
@@ -3,6 +3,9 @@
 # Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
 
 import os
+import platform
+import shlex
+import subprocess
 import sys
 from pathlib import Path
 
@@ -12,11 +15,40 @@ from setuptools import setup
 
 
 PLATFORM = sys.platform.lower()
+MACHINE = platform.machine().lower()
 
 DISABLE_NATIVE = os.environ.get("UNWIND_NATIVE_DISABLE")
 
+
+def has_library(name):
+    # The compiler prints the name back as is when it cannot find the file.
+    try:
+        path = subprocess.run(
+            shlex.split(os.environ.get("CC", "cc")) + [f"-print-file-name={name}"],
+            capture_output=True,
+            text=True,
+        ).stdout.strip()
+    except OSError:
+        return False
+    return os.path.isabs(path) and os.path.exists(path)
+
+
+# The remote unwinding API of libunwind, used to unwind the stacks sampled with
+# perf events, is only available from the architecture-specific library, which
+# not all distributions ship.
+LIBUNWIND_REMOTE = f"libunwind-{MACHINE}.a"
+PERF_NATIVE = (
+    PLATFORM == "linux"
+    and not DISABLE_NATIVE
+    and MACHINE in ("x86_64", "aarch64")
+    and has_library(LIBUNWIND_REMOTE)
+)
+
 LDADD = {
-    "linux": ["-l:libunwind.a", "-l:liblzma.a"] if not DISABLE_NATIVE else [],
+    "linux": ([f"-l:{LIBUNWIND_REMOTE}"] if PERF_NATIVE else [])
+    + ["-l:libunwind.a", "-l:liblzma.a"]
+    if not DISABLE_NATIVE
+    else [],
 }
 
 # add option to colorize compiler output
@@ -32,6 +64,9 @@ else:
 if DISABLE_NATIVE:
     CFLAGS += ["-DUNWIND_NATIVE_DISABLE"]
 
+if PERF_NATIVE:
+    CFLAGS += ["-DPERF_NATIVE_SUPPORTED"]
+
 echionmodule = Extension(
     "echion.core",
     sources=["echion/coremodule.cc", "echion/frame.cc", "echion/render.cc"],
@@ -0,0 +1,37 @@
+import asyncio
+import sys
+
+
+async def leaf():
+    await asyncio.sleep(0.5)
+
+
+async def with_wait():
+    await asyncio.wait([asyncio.create_task(leaf(), name="Wait")])
+
+
+async def with_shield():
+    await asyncio.shield(asyncio.create_task(leaf(), name="Shield"))
+
+
+async def with_as_completed():
+    for f in asyncio.as_completed(
+        [asyncio.create_task(leaf(), name="AsCompleted")]
+    ):
+        await f
+
+
+async def with_task_group():
+    async with asyncio.TaskGroup() as tg:
+        tg.create_task(leaf(), name="TaskGroup")
+
+
+async def main():
+    await with_wait()
+    await with_shield()
+    await with_as_completed()
+    if sys.version_info >= (3, 11):
+        await with_task_group()
+
+
+asyncio.run(main())
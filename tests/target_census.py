@@ -0,0 +1,18 @@
+import json
+import time
+
+from echion.core import type_census
+
+
+class Leak:
+    pass
+
+
+if __name__ == "__main__":
+    leaks = [Leak() for _ in range(10000)]
+
+    # Let the sampler take a census while the objects are alive
+    time.sleep(1.5)
+
+    count, size = type_census()["Leak"]
+    print(json.dumps({"count": count, "size": size}))
@@ -0,0 +1,34 @@
+import gc
+import threading
+from time import monotonic as time
+from time import sleep
+
+
+class Node:
+    def __init__(self):
+        self.ref = self
+
+
+def make_garbage():
+    for _ in range(200000):
+        Node()
+
+
+def collect():
+    end = time() + 1
+    while time() <= end:
+        make_garbage()
+        gc.collect()
+
+
+def idle():
+    sleep(1)
+
+
+if __name__ == "__main__":
+    gc.disable()
+
+    t = threading.Thread(target=idle, name="SecondaryThread")
+    t.start()
+    collect()
+    t.join()
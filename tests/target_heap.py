@@ -0,0 +1,35 @@
+import json
+import os
+import signal
+
+from echion.heap import diff
+from echion.heap import snapshot
+
+
+a = []
+
+
+def leak(n):
+    for _ in range(n):
+        a.append(bytearray(1024))
+
+
+if __name__ == "__main__":
+    leak(100)
+
+    before = snapshot()
+    leak(1000)
+    after = snapshot()
+
+    # Also request a heap dump on standard error
+    os.kill(os.getpid(), signal.SIGUSR2)
+
+    print(
+        json.dumps(
+            [
+                {"stack": [name for _, name, _ in stack], "size": size, "count": count}
+                for stack, size, count in diff(before, after)
+                if stack[-1][1] == "leak" and size > 0
+            ]
+        )
+    )
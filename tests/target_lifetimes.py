@@ -0,0 +1,51 @@
+import json
+import time
+
+from echion.heap import lifetimes
+
+
+def churn():
+    # Short-lived allocations
+    for _ in range(1000):
+        bytearray(1024)
+
+
+def retain():
+    # Allocations that outlive the sleep below
+    a = []
+    for _ in range(100):
+        a.append(bytearray(1024))
+    return a
+
+
+if __name__ == "__main__":
+    churn()
+
+    a = retain()
+    time.sleep(0.2)
+    del a
+
+    # Merge the histograms of the stacks of each function
+    histograms = {}
+    for stack, histogram in lifetimes().items():
+        if stack and stack[-1][1] in ("churn", "retain"):
+            merged = histograms.setdefault(stack[-1][1], [0] * len(histogram))
+            for i, count in enumerate(histogram):
+                merged[i] += count
+
+    def median(histogram):
+        half = (sum(histogram) + 1) // 2
+        total = 0
+        for i, count in enumerate(histogram):
+            total += count
+            if total >= half:
+                return i
+
+    print(
+        json.dumps(
+            {
+                name: {"median": median(histogram), "count": sum(histogram)}
+                for name, histogram in histograms.items()
+            }
+        )
+    )
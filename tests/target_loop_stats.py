@@ -0,0 +1,27 @@
+import asyncio
+import json
+import time
+
+from echion.core import loop_stats
+
+
+def noop():
+    pass
+
+
+async def main():
+    loop = asyncio.get_running_loop()
+
+    # Queue some callbacks and block the loop, so that they have to wait.
+    for _ in range(100):
+        loop.call_soon(noop)
+
+    time.sleep(0.5)
+
+    await asyncio.sleep(0)
+
+    print(json.dumps(list(loop_stats().values())))
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
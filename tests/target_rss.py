@@ -0,0 +1,38 @@
+import json
+import time
+
+from echion.heap import rss
+
+
+a = []
+
+
+def grow():
+    # Touch every page so that the memory is actually resident
+    a.append(bytes(range(256)) * 4096)
+
+
+def churn():
+    for _ in range(1000):
+        str(list(range(10)))
+
+
+if __name__ == "__main__":
+    for _ in range(32):
+        grow()
+        churn()
+        time.sleep(0.01)
+
+    # Give the sampler a chance to flush the stats
+    time.sleep(0.1)
+
+    growth = rss()
+
+    print(
+        json.dumps(
+            {
+                "grow": sum(size for stack, size in growth.items() if stack and stack[-1][1] == "grow"),
+                "total": sum(growth.values()),
+            }
+        )
+    )
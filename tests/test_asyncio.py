@@ -1,4 +1,8 @@
+import json
 import sys
+from importlib.util import find_spec
+
+import pytest
 
 from tests.utils import PY
 from tests.utils import DataSummary
@@ -85,3 +89,85 @@ def test_asyncio_gather_wall_time():
                 ),
                 lambda v: v >= 0.45e6,
             )
+
+
+def test_asyncio_gather_task_sampling():
+    result, data = run_target("target_gather", "--task-sample-size", "1")
+    assert result.returncode == 0, result.stderr.decode()
+
+    summary = DataSummary(data)
+
+    # Only one of the two idle leaf tasks is unwound at each tick, but its
+    # metric is scaled up, so both should account for roughly 2 seconds.
+    for t in ("F4_0", "F4_1"):
+        value = summary.query("0:MainThread", ((t, 0), ("f4", 22), ("f5", 26)))
+        assert value is not None
+        assert 1.4e6 <= value <= 2.6e6, value
+
+
+def test_asyncio_links():
+    result, data = run_target("target_async_links")
+    assert result.returncode == 0, result.stderr.decode()
+
+    summary = DataSummary(data)
+
+    # The awaited tasks are reported on top of the task that awaits them
+    links = [
+        ("with_wait", "Wait"),
+        ("with_shield", "Shield"),
+        ("with_as_completed", "AsCompleted"),
+    ]
+    if PY >= (3, 11):
+        links.append(("with_task_group", "TaskGroup"))
+
+    for parent, child in links:
+        assert any(
+            v >= 0.4e6
+            for stack, v in summary.threads["0:MainThread"].items()
+            if parent in stack
+            and child in stack
+            and stack.index(parent) < stack.index(child)
+        ), (parent, child)
+
+
+def test_asyncio_gather_idle():
+    result, data = run_target("target_gather", "--idle")
+    assert result.returncode == 0, result.stderr.decode()
+
+    summary = DataSummary(data)
+
+    # The loop is waiting on the sleeping tasks most of the time, so the thread
+    # stack is reported as idle in the selector, without unwinding the tasks.
+    stacks = summary.threads["0:MainThread"]
+    assert not any("F4_0" in stack or "F4_1" in stack for stack in stacks)
+
+    idle = 0
+    for sample in data.samples:
+        if sample.idle and sample.thread == "MainThread":
+            assert sample.frames[-1].scope.string.value.endswith("select"), sample
+            idle += sample.metrics[0].value
+    assert idle >= 1.4e6, idle
+
+
+def test_asyncio_loop_stats():
+    result, _ = run_target("target_loop_stats")
+    assert result.returncode == 0, result.stderr.decode()
+
+    (stats,) = json.loads(result.stdout.decode())
+
+    # The queued callbacks wait for as long as the loop is blocked.
+    assert stats["max_depth"] >= 100, stats
+    assert 0.4 <= stats["max_lag"] <= 0.6, stats
+
+
+@pytest.mark.skipif(find_spec("uvloop") is None, reason="uvloop not available")
+def test_asyncio_uvloop():
+    result, data = run_target("target_uvloop")
+    assert result.returncode == 0, result.stderr.decode()
+
+    summary = DataSummary(data)
+
+    # The tasks of a uvloop loop are unwound just like those of an asyncio loop
+    for t in ("F4_0", "F4_1"):
+        value = summary.query("0:MainThread", ((t, 0), ("f4", 24), ("f5", 28)))
+        assert value is not None and value >= 1.4e6, value
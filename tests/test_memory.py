@@ -1,3 +1,5 @@
+import json
+
 import pytest
 
 from tests.utils import DataSummary, run_target
@@ -20,3 +22,79 @@ def test_memory():
     assert (
         summary.query("0:MainThread", (("<module>", 25), ("leak", 21))) is not None
     ), summary.threads["0:MainThread"]
+
+
+def test_memory_sampling():
+    result, data = run_target("target_mem", "--memory-sampling-rate", "256")
+    assert result.returncode == 0, result.stderr.decode()
+
+    md = data.metadata
+    assert md["mode"] == "memory"
+    assert md["memory_sampling_rate"] == "256"
+
+    summary = DataSummary(data)
+
+    assert (
+        summary.query("0:MainThread", (("<module>", 25), ("leak", 21))) is not None
+    ), summary.threads["0:MainThread"]
+
+
+def test_memory_heap_snapshot():
+    result, _ = run_target("target_heap", "-m")
+    assert result.returncode == 0, result.stderr.decode()
+
+    # Only the allocations made between the two snapshots are reported
+    (leak,) = json.loads(result.stdout.decode())
+    assert leak["stack"][-2:] == ["<module>", "leak"], leak
+    assert leak["count"] >= 1000, leak
+    assert leak["size"] >= 1000 * 1024, leak
+
+    # The heap dump requested with SIGUSR2 is written to standard error
+    assert "Echion heap snapshot" in result.stderr.decode()
+
+
+def test_memory_rss():
+    result, _ = run_target("target_rss", "-m")
+    assert result.returncode == 0, result.stderr.decode()
+
+    # The stack that retains memory takes most of the RSS growth, while the
+    # one that frees everything it allocates takes next to none.
+    rss = json.loads(result.stdout.decode())
+    assert rss["grow"] >= 16 << 20, rss
+    assert rss["grow"] >= rss["total"] // 2, rss
+
+
+def test_memory_lifetimes():
+    result, _ = run_target("target_lifetimes", "-m")
+    assert result.returncode == 0, result.stderr.decode()
+
+    lifetimes = json.loads(result.stdout.decode())
+
+    # Short-lived allocations are freed within a few milliseconds...
+    churn = lifetimes["churn"]
+    assert churn["count"] >= 2000, churn
+    assert churn["median"] <= 12, churn
+
+    # ... whereas retained ones outlive the 200 ms sleep
+    retain = lifetimes["retain"]
+    assert retain["count"] >= 100, retain
+    assert retain["median"] >= 17, retain
+
+
+def test_memory_census():
+    result, data = run_target("target_census", "--census", "1")
+    assert result.returncode == 0, result.stderr.decode()
+
+    md = data.metadata
+    assert md["mode"] == "memory"
+    assert md["census"] == "1"
+
+    # The exact census taken with the GIL held
+    census = json.loads(result.stdout.decode())
+    assert census["count"] == 10000, census
+
+    # The census taken by the sampler thread, without the GIL, is reported as
+    # a memory sample of the type
+    summary = DataSummary(data)
+    size = summary.query("0:Heap census", (("Leak", 0),))
+    assert size == census["size"], summary.threads["0:Heap census"]
@@ -156,3 +156,17 @@ def test_wall_time_native(stealth):
     else:
         assert summary.query("0:MainThread", (("bar", 17),)) is not None
         assert summary.query("0:SecondaryThread", (("foo", 13),)) is not None
+
+
+def test_wall_time_gc():
+    result, data = run_target("target_gc", "-g")
+    assert result.returncode == 0, result.stderr.decode()
+
+    gc_time = {}
+    for sample in data.samples:
+        if sample.gc and sample.thread:
+            gc_time[sample.thread] = gc_time.get(sample.thread, 0) + sample.metrics[0].value
+
+    # Only the thread that runs the collections is tagged.
+    assert set(gc_time) == {"MainThread"}, gc_time
+    assert gc_time["MainThread"] >= 0.2e6, gc_time